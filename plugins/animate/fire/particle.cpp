@@ -1,161 +1,221 @@
 #include "particle.hpp"
 #include "shaders.hpp"
 #include <wayfire/core.hpp>
-#include <thread>
-
-void Particle::update(float time)
+#include <wayfire/thread-pool.hpp>
+#include <cmath>
+
+/* The particle update is compiled for several instruction sets, and the best
+ * one supported by the CPU is picked when the plugin is loaded. Elsewhere the
+ * baseline instruction set is used, which already has vector instructions on
+ * the architectures we care about (for ex. NEON on aarch64). */
+#if defined(__x86_64__) && defined(__has_attribute)
+ #if __has_attribute(target_clones)
+  #define PARTICLE_UPDATE_TARGETS \
+    __attribute__((target_clones("avx2", "sse4.2", "default")))
+ #endif
+#endif
+
+#ifndef PARTICLE_UPDATE_TARGETS
+ #define PARTICLE_UPDATE_TARGETS
+#endif
+
+/* Advance the alive particles in [start, end) by one step.
+ * The loop body is branch-free, so that it can be vectorized.
+ *
+ * returns the number of particles which died during this step */
+PARTICLE_UPDATE_TARGETS
+static int update_particles(int start, int end,
+    float *__restrict life, const float *__restrict fade,
+    float *__restrict radius, const float *__restrict base_radius,
+    float *__restrict center_x, float *__restrict center_y,
+    float *__restrict speed_x, float *__restrict speed_y,
+    float *__restrict g_x, const float *__restrict g_y,
+    const float *__restrict start_x,
+    float *__restrict alpha, const float *__restrict alpha_per_life)
 {
-    if (life <= 0) // ignore
-    {
-        return;
-    }
-
-    const float slowdown = 0.8;
+    const float slowdown   = 0.8;
+    const float move_step  = 0.2f * slowdown;
+    const float accel_step = 0.3f * slowdown;
 
-    pos   += speed * 0.2f * slowdown;
-    speed += g * 0.3f * slowdown;
-
-    if (life != 0)
+    int died = 0;
+    #pragma omp simd reduction(+:died)
+    for (int i = start; i < end; i++)
     {
-        color.a /= life;
+        const float old_life = life[i];
+        /* 1 for alive particles, 0 for dead ones, which don't move */
+        const float alive = (old_life > 0) ? 1.0f : 0.0f;
+
+        const float new_life = old_life - fade[i] * accel_step * alive;
+        const float x = center_x[i] + speed_x[i] * move_step * alive;
+        const float y = center_y[i] + speed_y[i] * move_step * alive;
+        speed_x[i] += g_x[i] * accel_step * alive;
+        speed_y[i] += g_y[i] * accel_step * alive;
+
+        radius[i] = base_radius[i] * std::sqrt((new_life > 0) ? new_life : 0.0f);
+        alpha[i]  = alpha_per_life[i] * new_life;
+        g_x[i]    = (start_x[i] < x) ? -1.0f : 1.0f;
+
+        /* move dead particles outside */
+        const bool dead = new_life <= 0;
+        center_x[i] = dead ? -10000.0f : x;
+        center_y[i] = dead ? -10000.0f : y;
+        life[i]     = new_life;
+
+        died += (dead ? 1 : 0) * (int)alive;
     }
 
-    life    -= fade * 0.3 * slowdown;
-    radius   = base_radius * std::pow(life, 0.5);
-    color.a *= life;
-
-    if (start_pos.x < pos.x)
-    {
-        g.x = -1;
-    } else
-    {
-        g.x = 1;
-    }
-
-    if (life <= 0)
-    {
-        /* move outside */
-        pos = {-10000, -10000};
-    }
+    return died;
 }
 
 ParticleSystem::ParticleSystem(int particles, ParticleIniter init_func)
 {
     this->pinit_func = init_func;
+    particles_alive.store(0);
 
     resize(particles);
     last_update_msec = wf::get_current_time();
     create_program();
-
-    particles_alive.store(0);
 }
 
 ParticleSystem::~ParticleSystem()
 {
     OpenGL::render_begin();
     program.free_resources();
+    GL_CALL(glDeleteBuffers(1, &vbo));
     OpenGL::render_end();
 }
 
-int ParticleSystem::spawn(int num)
+void ParticleSystem::init_particle(int i)
 {
-    // TODO: multithread this
-    int spawned = 0;
-    for (size_t i = 0; i < ps.size() && spawned < num; i++)
+    Particle p;
+    pinit_func(p);
+
+    particles.life[i] = p.life;
+    particles.fade[i] = p.fade;
+    particles.radius[i]      = p.radius;
+    particles.base_radius[i] = p.base_radius;
+    particles.center_x[i]    = p.pos.x;
+    particles.center_y[i]    = p.pos.y;
+    particles.speed_x[i]     = p.speed.x;
+    particles.speed_y[i]     = p.speed.y;
+    particles.g_x[i]     = p.g.x;
+    particles.g_y[i]     = p.g.y;
+    particles.start_x[i] = p.start_pos.x;
+    particles.alpha[i]   = p.color.a;
+    particles.alpha_per_life[i] = (p.life > 0) ? p.color.a / p.life : 0;
+    for (int j = 0; j < 3; j++)
     {
-        if (ps[i].life <= 0)
-        {
-            pinit_func(ps[i]);
-            ++spawned;
-            ++particles_alive;
-        }
+        particles.rgb[3 * i + j] = p.color[j];
     }
-
-    return spawned;
 }
 
-void ParticleSystem::resize(int num)
+int ParticleSystem::spawn(int num)
 {
-    if (num == (int)ps.size())
+    if (num <= 0)
     {
-        return;
+        return 0;
     }
 
-    // TODO: multithread this
-    for (int i = num; i < (int)ps.size(); i++)
+    /* The first num dead particles are respawned. To initialize the parts of
+     * the system in parallel, first count the dead particles in each part, and
+     * then decide how many of them to respawn in each part. */
+    auto& pool = *wf::get_core().thread_pool;
+    const int num_parts =
+        (num_particles + particles_per_task - 1) / particles_per_task;
+    spawn_quota.assign(num_parts, 0);
+
+    pool.parallel_for(num_parts, 1, [=] (int start, int end)
     {
-        if (ps[i].life >= 0)
+        for (int part = start; part < end; part++)
         {
-            --particles_alive;
+            int last = std::min((part + 1) * particles_per_task, num_particles);
+            for (int i = part * particles_per_task; i < last; i++)
+            {
+                spawn_quota[part] += (particles.life[i] <= 0);
+            }
         }
+    });
+
+    int spawned = 0;
+    for (auto& quota : spawn_quota)
+    {
+        quota    = std::min(quota, num - spawned);
+        spawned += quota;
     }
 
-    ps.resize(num);
+    pool.parallel_for(num_parts, 1, [=] (int start, int end)
+    {
+        for (int part = start; part < end; part++)
+        {
+            int left = spawn_quota[part];
+            int last = std::min((part + 1) * particles_per_task, num_particles);
+            for (int i = part * particles_per_task; i < last && left > 0; i++)
+            {
+                if (particles.life[i] <= 0)
+                {
+                    init_particle(i);
+                    --left;
+                }
+            }
+        }
+    });
 
-    color.resize(color_per_particle * num);
-    dark_color.resize(color_per_particle * num);
-    radius.resize(radius_per_particle * num);
-    center.resize(center_per_particle * num);
-}
+    particles_alive += spawned;
+    vbo_dirty = vbo_dirty || spawned;
 
-int ParticleSystem::size()
-{
-    return ps.size();
+    return spawned;
 }
 
-void ParticleSystem::update_worker(float time, int start, int end)
+void ParticleSystem::resize(int num)
 {
-    end = std::min(end, (int)ps.size());
-    for (int i = start; i < end; ++i)
+    if (num == num_particles)
     {
-        if (ps[i].life <= 0)
-        {
-            continue;
-        }
-
-        // printf("%d\n", i);
-        ps[i].update(time);
-
-        if (ps[i].life <= 0)
-        {
-            --particles_alive;
-        }
+        return;
+    }
 
-        for (int j = 0; j < 4; j++) // maybe use memcpy?
+    wf::get_core().thread_pool->parallel_for(std::max(0, num_particles - num),
+        particles_per_task, [=] (int start, int end)
+    {
+        int lost = 0;
+        for (int i = num + start; i < num + end; i++)
         {
-            color[4 * i + j] = ps[i].color[j];
-            dark_color[4 * i + j] = ps[i].color[j] * 0.5;
+            lost += (particles.life[i] > 0);
         }
 
-        // printf("center %d gets %f", 2 * i, ps[i].pos[0]);
-        center[2 * i]     = ps[i].pos[0];
-        center[2 * i + 1] = ps[i].pos[1];
+        particles_alive -= lost;
+    });
 
-        radius[i] = ps[i].radius;
+    num_particles = num;
+    particles.life.resize(num, -1);
+    for (auto array : {&particles.radius, &particles.center_x,
+                       &particles.center_y, &particles.alpha, &particles.fade,
+                       &particles.base_radius, &particles.speed_x,
+                       &particles.speed_y, &particles.g_x, &particles.g_y,
+                       &particles.start_x, &particles.alpha_per_life})
+    {
+        array->resize(num, 0);
     }
+
+    particles.rgb.resize(3 * num, 0);
+    vbo_dirty = true;
 }
 
-void ParticleSystem::exec_worker_threads(std::function<void(int, int)> spawn_worker)
+int ParticleSystem::size()
 {
-// return spawn_worker(0, ps.size());
-
-    const int num_threads = std::thread::hardware_concurrency();
-    const int worker_load = (ps.size() + num_threads - 1) / num_threads;
-
-    std::thread workers[num_threads];
-    for (int i = 0; i < num_threads; i++)
-    {
-        int thread_start = i * worker_load;
-        int thread_end   = (i + 1) * worker_load;
-        thread_end = std::min(thread_end, (int)ps.size());
-
-        workers[i] = std::thread([=] () { spawn_worker(thread_start, thread_end); });
-    }
+    return num_particles;
+}
 
-    for (auto& w : workers)
-    {
-        w.join();
-    }
+void ParticleSystem::update_worker(float time, int start, int end)
+{
+    end = std::min(end, num_particles);
+    particles_alive -= update_particles(start, end,
+        particles.life.data(), particles.fade.data(),
+        particles.radius.data(), particles.base_radius.data(),
+        particles.center_x.data(), particles.center_y.data(),
+        particles.speed_x.data(), particles.speed_y.data(),
+        particles.g_x.data(), particles.g_y.data(),
+        particles.start_x.data(),
+        particles.alpha.data(), particles.alpha_per_life.data());
 }
 
 void ParticleSystem::update()
@@ -164,10 +224,13 @@ void ParticleSystem::update()
     float time = (wf::get_current_time() - last_update_msec) / 16.0;
     last_update_msec = wf::get_current_time();
 
-    exec_worker_threads([=] (int start, int end)
+    wf::get_core().thread_pool->parallel_for(num_particles, particles_per_task,
+        [=] (int start, int end)
     {
         update_worker(time, start, end);
     });
+
+    vbo_dirty = true;
 }
 
 int ParticleSystem::statistic()
@@ -181,9 +244,43 @@ void ParticleSystem::create_program()
     OpenGL::render_begin();
     program.set_simple(OpenGL::compile_program(particle_vert_source,
         particle_frag_source));
+    GL_CALL(glGenBuffers(1, &vbo));
     OpenGL::render_end();
 }
 
+/* offsets of the rendered attributes in the vbo, in particles */
+enum particle_attribute_offset
+{
+    RADIUS_OFFSET   = 0,
+    CENTER_X_OFFSET = 1,
+    CENTER_Y_OFFSET = 2,
+    ALPHA_OFFSET    = 3,
+    RGB_OFFSET      = 4,
+    ATTRIBUTES_SIZE = 7,
+};
+
+void ParticleSystem::upload_attributes()
+{
+    const GLsizeiptr n = num_particles * sizeof(float);
+
+    /* Orphan the old storage, so that we don't wait for the draws which
+     * still use it */
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER, ATTRIBUTES_SIZE * n, NULL,
+        GL_STREAM_DRAW));
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, RADIUS_OFFSET * n, n,
+        particles.radius.data()));
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, CENTER_X_OFFSET * n, n,
+        particles.center_x.data()));
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, CENTER_Y_OFFSET * n, n,
+        particles.center_y.data()));
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, ALPHA_OFFSET * n, n,
+        particles.alpha.data()));
+    GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, RGB_OFFSET * n, 3 * n,
+        particles.rgb.data()));
+
+    vbo_dirty = false;
+}
+
 void ParticleSystem::render(glm::mat4 matrix)
 {
     program.use(wf::TEXTURE_TYPE_RGBA);
@@ -194,34 +291,51 @@ void ParticleSystem::render(glm::mat4 matrix)
         -1, 1
     };
 
+    /* The quad is a client-side array, the particles are in the vbo */
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
     program.attrib_pointer("position", 2, 0, vertex_data);
     program.attrib_divisor("position", 0);
 
-    program.attrib_pointer("radius", 1, 0, radius.data());
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    if (vbo_dirty)
+    {
+        upload_attributes();
+    }
+
+    const size_t n = num_particles * sizeof(float);
+    auto offset    = [=] (int attribute) { return (void*)(attribute * n); };
+
+    program.attrib_pointer("radius", 1, 0, offset(RADIUS_OFFSET));
     program.attrib_divisor("radius", 1);
 
-    program.attrib_pointer("center", 2, 0, center.data());
-    program.attrib_divisor("center", 1);
+    program.attrib_pointer("center_x", 1, 0, offset(CENTER_X_OFFSET));
+    program.attrib_divisor("center_x", 1);
+    program.attrib_pointer("center_y", 1, 0, offset(CENTER_Y_OFFSET));
+    program.attrib_divisor("center_y", 1);
+
+    program.attrib_pointer("alpha", 1, 0, offset(ALPHA_OFFSET));
+    program.attrib_divisor("alpha", 1);
+    program.attrib_pointer("color", 3, 0, offset(RGB_OFFSET));
+    program.attrib_divisor("color", 1);
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
 
     // matrix
     program.uniformMatrix4f("matrix", matrix);
 
     /* Darken the background */
-    program.attrib_pointer("color", 4, 0, dark_color.data());
-    program.attrib_divisor("color", 1);
-
     GL_CALL(glEnable(GL_BLEND));
     GL_CALL(glBlendFunc(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA));
+    program.uniform1f("color_factor", 0.5);
     program.uniform1f("smoothing", 0.7);
 
     // TODO: optimize shaders for this case
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, num_particles));
 
     // particle color
-    program.attrib_pointer("color", 4, 0, color.data());
     GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE));
+    program.uniform1f("color_factor", 1.0);
     program.uniform1f("smoothing", 0.5);
-    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, ps.size()));
+    GL_CALL(glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, num_particles));
 
     GL_CALL(glDisable(GL_BLEND));
     GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
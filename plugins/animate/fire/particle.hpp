@@ -6,6 +6,7 @@
 #include <atomic>
 #include <vector>
 
+/* the initial state of a particle, filled in by the ParticleIniter */
 struct Particle
 {
     float life = -1;
@@ -17,14 +18,10 @@ struct Particle
     glm::vec2 start_pos;
 
     glm::vec4 color{1.0, 1.0, 1.0, 1.0};
-
-    /* update the given particle
-     * time is the percentage of the frame which has elapsed
-     * must be thread-safe */
-    void update(float time);
 };
 
-/* a function to initialize a particle */
+/* a function to initialize a particle
+ * must be thread-safe */
 using ParticleIniter = std::function<void (Particle&)>;
 
 class ParticleSystem
@@ -65,20 +62,44 @@ class ParticleSystem
     uint32_t last_update_msec;
 
     std::atomic<int> particles_alive;
-    std::vector<Particle> ps;
-
-    static constexpr int color_per_particle = 4;
-    std::vector<float> color, dark_color;
-
-    static constexpr int radius_per_particle = 1;
-    std::vector<float> radius;
-
-    static constexpr int center_per_particle = 2;
-    std::vector<float> center;
+    int num_particles = 0;
+
+    /* The particles are stored as a structure of arrays, one element per
+     * particle, so that updating them can be vectorized.
+     *
+     * The attributes which are rendered are uploaded to the GPU as they are,
+     * without any per-frame repacking. */
+    struct
+    {
+        /* rendered attributes */
+        std::vector<float> radius;
+        std::vector<float> center_x, center_y;
+        std::vector<float> alpha;
+        std::vector<float> rgb; // 3 per particle
+
+        /* simulation-only attributes */
+        std::vector<float> life, fade, base_radius;
+        std::vector<float> speed_x, speed_y;
+        std::vector<float> g_x, g_y;
+        std::vector<float> start_x;
+        /* the alpha of a particle fades linearly with its life */
+        std::vector<float> alpha_per_life;
+    } particles;
+
+    /* particles are processed in parts of this size on the core thread pool */
+    static constexpr int particles_per_task = 512;
+    /* how many particles to respawn in each part */
+    std::vector<int> spawn_quota;
+
+    /* the buffer to which the rendered attributes are uploaded, and whether
+     * they have changed since the last upload */
+    GLuint vbo = 0;
+    bool vbo_dirty = true;
 
     OpenGL::program_t program;
-    void exec_worker_threads(std::function<void(int, int)> spawn_worker);
+    void init_particle(int i);
     void update_worker(float time, int start, int end);
+    void upload_attributes();
     void create_program();
 };
 
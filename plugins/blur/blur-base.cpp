@@ -2,6 +2,7 @@
 #include <wayfire/output.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/util/log.hpp>
+#include <cmath>
 
 static const char *blur_blend_vertex_shader =
     R"(
@@ -62,6 +63,7 @@ wf_blur_base::~wf_blur_base()
     OpenGL::render_begin();
     fb[0].release();
     fb[1].release();
+    shared_fb.release();
     program[0].free_resources();
     program[1].free_resources();
     blend_program.free_resources();
@@ -96,9 +98,7 @@ void wf_blur_base::render_iteration(wf::region_t blur_region,
 wlr_box wf_blur_base::copy_region(wf::framebuffer_base_t& result,
     const wf::framebuffer_t& source, const wf::region_t& region)
 {
-    auto subbox = source.framebuffer_box_from_geometry_box(
-        wlr_box_from_pixman_box(region.get_extents()));
-
+    auto subbox = wlr_box_from_pixman_box(region.get_extents());
     auto source_box =
         source.framebuffer_box_from_geometry_box(source.geometry);
 
@@ -115,42 +115,58 @@ wlr_box wf_blur_base::copy_region(wf::framebuffer_base_t& result,
 
     GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, source.fb));
     GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, result.fb));
-    GL_CALL(glBlitFramebuffer(
-        subbox.x, source_box.height - subbox.y - subbox.height,
-        subbox.x + subbox.width, source_box.height - subbox.y,
-        0, 0, rounded_width, rounded_height,
-        GL_COLOR_BUFFER_BIT, GL_LINEAR));
+
+    /* Copy only the pixels which the blur of region samples, and not the
+     * whole extents, which may contain large parts hidden by the view, for ex.
+     * when only the corners of an opaque view are transparent. The blits are
+     * clipped by the scissor box, which is in the coordinates of result */
+    wf::region_t sampled = region;
+    sampled.expand_edges(calculate_blur_radius());
+
+    const double scale_x = (double)rounded_width / std::max(1, subbox.width);
+    const double scale_y = (double)rounded_height / std::max(1, subbox.height);
+    for (const auto& rect : sampled)
+    {
+        int x1 = std::floor((rect.x1 - subbox.x) * scale_x) - 1;
+        int y1 = std::floor((rect.y1 - subbox.y) * scale_y) - 1;
+        int x2 = std::ceil((rect.x2 - subbox.x) * scale_x) + 1;
+        int y2 = std::ceil((rect.y2 - subbox.y) * scale_y) + 1;
+        result.scissor({x1, y1, x2 - x1, y2 - y1});
+
+        GL_CALL(glBlitFramebuffer(
+            subbox.x, source_box.height - subbox.y - subbox.height,
+            subbox.x + subbox.width, source_box.height - subbox.y,
+            0, 0, rounded_width, rounded_height,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR));
+    }
+
     OpenGL::render_end();
 
     return subbox;
 }
 
-void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
-    const wf::region_t& damage, const wf::framebuffer_t& target_fb)
+wf::dimensions_t wf_blur_base::get_scaled_size(wlr_box box)
+{
+    int degrade = degrade_opt;
+    return {std::max(1, box.width / degrade), std::max(1, box.height / degrade)};
+}
+
+wlr_box wf_blur_base::blur_region(const wf::framebuffer_t& source,
+    const wf::region_t& region)
 {
     int degrade     = degrade_opt;
-    auto damage_box = copy_region(fb[0], target_fb, damage);
-    int scaled_width  = std::max(1, damage_box.width / degrade);
-    int scaled_height = std::max(1, damage_box.height / degrade);
+    auto damage_box = copy_region(fb[0], source, region);
+    auto scaled     = get_scaled_size(damage_box);
 
     /* As an optimization, we create a region that blur can use
-     * to perform minimal rendering required to blur. We start
-     * by translating the input damage region */
-    wf::region_t blur_damage;
-    for (auto b : damage)
-    {
-        blur_damage |= target_fb.framebuffer_box_from_geometry_box(
-            wlr_box_from_pixman_box(b));
-    }
-
-    /* Scale and translate the region */
-    blur_damage += -wf::point_t{damage_box.x, damage_box.y};
+     * to perform minimal rendering required to blur.
+     * Scale and translate the region */
+    wf::region_t blur_damage = region + -wf::point_t{damage_box.x, damage_box.y};
     blur_damage *= 1.0 / degrade;
 
-    int r = blur_fb0(blur_damage, scaled_width, scaled_height);
+    int r = blur_fb0(blur_damage, scaled.width, scaled.height);
 
-    /* Make sure the result is always fb[1], because that's what is used in render()
-     * */
+    /* Make sure the result is always fb[0] */
     if (r != 0)
     {
         std::swap(fb[0], fb[1]);
@@ -165,43 +181,135 @@ void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
             damage_box.height + damage_box.height %
             degrade);
         OpenGL::render_begin();
-        fb[1].allocate(scaled_width, scaled_height);
+        fb[1].allocate(scaled.width, scaled.height);
         fb[1].bind();
         GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, fb[0].fb));
         GL_CALL(glBlitFramebuffer(0, 0, rounded_width, rounded_height,
-            0, 0, scaled_width, scaled_height,
+            0, 0, scaled.width, scaled.height,
             GL_COLOR_BUFFER_BIT, GL_LINEAR));
         OpenGL::render_end();
         std::swap(fb[0], fb[1]);
     }
 
-    /* we subtract target_fb's position to so that
-     * view box is relative to framebuffer */
-    auto view_box = target_fb.framebuffer_box_from_geometry_box(src_box);
+    return damage_box;
+}
+
+void wf_blur_base::blit_blurred(const wf::framebuffer_base_t& blurred,
+    wlr_box blurred_box, wlr_box view_box, wf::framebuffer_base_t& result,
+    const wf::region_t *clip)
+{
+    auto scaled = get_scaled_size(blurred_box);
 
     OpenGL::render_begin();
-    fb[1].allocate(view_box.width, view_box.height);
-    fb[1].bind();
-    GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, fb[0].fb));
+    result.allocate(view_box.width, view_box.height);
+    result.bind();
+    GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, blurred.fb));
 
     /* Blit the blurred texture into an fb which has the size of the view,
      * so that the view texture and the blurred background can be combined
      * together in render()
      *
-     * local_geometry is damage_box relative to view box */
-    wlr_box local_box = damage_box + wf::point_t{-view_box.x, -view_box.y};
-    GL_CALL(glBlitFramebuffer(0, 0, scaled_width, scaled_height,
-        local_box.x,
-        view_box.height - local_box.y - local_box.height,
-        local_box.x + local_box.width,
-        view_box.height - local_box.y,
-        GL_COLOR_BUFFER_BIT, GL_LINEAR));
+     * local_box is blurred_box relative to view box */
+    wlr_box local_box = blurred_box + wf::point_t{-view_box.x, -view_box.y};
+    auto blit = [&] ()
+    {
+        GL_CALL(glBlitFramebuffer(0, 0, scaled.width, scaled.height,
+            local_box.x,
+            view_box.height - local_box.y - local_box.height,
+            local_box.x + local_box.width,
+            view_box.height - local_box.y,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR));
+    };
+
+    if (clip)
+    {
+        /* Blits are clipped by the scissor box */
+        for (const auto& rect : *clip)
+        {
+            result.scissor(wlr_box_from_pixman_box(rect) +
+                wf::point_t{-view_box.x, -view_box.y});
+            blit();
+        }
+    } else
+    {
+        blit();
+    }
+
     GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
     OpenGL::render_end();
 }
 
+void wf_blur_base::schedule_shared(const wf::region_t& region,
+    const wf::framebuffer_t& target_fb)
+{
+    shared_region = region;
+    shared_target = target_fb.fb;
+    shared_state  = region.empty() ? SHARED_NONE : SHARED_PENDING;
+}
+
+void wf_blur_base::clear_shared()
+{
+    shared_region.clear();
+    shared_state = SHARED_NONE;
+}
+
+void wf_blur_base::pre_render(wf::texture_t src_tex, wlr_box src_box,
+    const wf::region_t& damage, const wf::framebuffer_t& target_fb,
+    wf::framebuffer_base_t& result, const wf::region_t& shared)
+{
+    /* The parts of damage which are covered by the shared background, in
+     * framebuffer coordinates */
+    wf::region_t from_shared;
+    wf::region_t own_damage = damage;
+    if ((shared_state != SHARED_NONE) && (target_fb.fb == shared_target))
+    {
+        own_damage ^= shared;
+        for (const auto& rect : damage & shared)
+        {
+            from_shared |= target_fb.framebuffer_box_from_geometry_box(
+                wlr_box_from_pixman_box(rect));
+        }
+    }
+
+    /* we subtract target_fb's position to so that
+     * view box is relative to framebuffer */
+    auto view_box = target_fb.framebuffer_box_from_geometry_box(src_box);
+    if (!own_damage.empty())
+    {
+        wf::region_t fb_damage;
+        for (const auto& rect : own_damage)
+        {
+            fb_damage |= target_fb.framebuffer_box_from_geometry_box(
+                wlr_box_from_pixman_box(rect));
+        }
+
+        auto blurred_box = blur_region(target_fb, fb_damage);
+        blit_blurred(fb[0], blurred_box, view_box, result, nullptr);
+    }
+
+    if (from_shared.empty())
+    {
+        return;
+    }
+
+    if (shared_state == SHARED_PENDING)
+    {
+        /* The first view which needs the shared background is the
+         * bottommost one, so the framebuffer contains the background of all
+         * views which use it */
+        shared_box = blur_region(target_fb, shared_region);
+        std::swap(fb[0], shared_fb);
+        shared_state = SHARED_DONE;
+    }
+
+    /* The own blur pass leaves artifacts in its whole extents, so the shared
+     * background is blitted after it */
+    blit_blurred(shared_fb, shared_box, view_box, result, &from_shared);
+}
+
 void wf_blur_base::render(wf::texture_t src_tex, wlr_box src_box,
-    wlr_box scissor_box, const wf::framebuffer_t& target_fb)
+    wlr_box scissor_box, const wf::framebuffer_t& target_fb,
+    const wf::framebuffer_base_t& blurred)
 {
     wlr_box fb_geom =
         target_fb.framebuffer_box_from_geometry_box(target_fb.geometry);
@@ -227,7 +335,7 @@ void wf_blur_base::render(wf::texture_t src_tex, wlr_box src_box,
 
     blend_program.set_active_texture(src_tex);
     GL_CALL(glActiveTexture(GL_TEXTURE0 + 1));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D, fb[1].tex));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, blurred.tex));
     /* Render it to target_fb */
     target_fb.bind();
     GL_CALL(glViewport(view_box.x, fb_geom.height - view_box.y - view_box.height,
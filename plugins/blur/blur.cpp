@@ -5,9 +5,82 @@
 #include <wayfire/workspace-stream.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/signal-definitions.hpp>
+#include <wayfire/nonstd/reverse.hpp>
 
 #include "blur.hpp"
 
+#include <map>
+#include <vector>
+
+/**
+ * The blurred background of a view, kept between frames. The background is
+ * blurred again only where something behind the view has changed, so that
+ * a view which just updates its own contents costs a single blend pass.
+ *
+ * The regions are relative to the view's bounding box, in the coordinate
+ * system of the damage passed to the transformer.
+ */
+struct blur_cache_t
+{
+    /* The blurred background, with the size of the view in the framebuffer */
+    wf::framebuffer_base_t fb;
+    /* The bounding box of the view, and the same box in the framebuffer */
+    wlr_box src_box = {0, 0, 0, 0};
+    wlr_box fb_box  = {0, 0, 0, 0};
+    /* The parts of fb which contain an up-to-date blurred background */
+    wf::region_t valid;
+
+    /** Drop the cached background if the view moved, was resized, or is
+     * rendered to a different framebuffer */
+    void set_box(wlr_box src, wlr_box target)
+    {
+        if ((src != src_box) || (target != fb_box))
+        {
+            src_box = src;
+            fb_box  = target;
+            valid.clear();
+        }
+    }
+
+    /** @return Whether the background in region is up-to-date */
+    bool covers(const wf::region_t& region) const
+    {
+        return ((region + wf::point_t{-src_box.x, -src_box.y}) ^ valid).empty();
+    }
+
+    /** Mark the background behind the damaged region as outdated */
+    void invalidate(const wf::region_t& damage)
+    {
+        valid ^= damage + wf::point_t{-src_box.x, -src_box.y};
+    }
+
+    /**
+     * Update the valid region after the background in blurred has been blurred
+     * again. The blur near the edges of the blurred region samples pixels
+     * which were not repainted in this frame, so they are considered valid
+     * only if they are at least padding away from those pixels.
+     *
+     * @param blurred The region passed to pre_render()
+     * @param opaque The opaque region of the view, which is never blurred
+     */
+    void update(const wf::region_t& blurred, const wf::region_t& opaque,
+        int padding)
+    {
+        const wf::point_t origin{-src_box.x, -src_box.y};
+        wf::region_t fresh = blurred + origin;
+
+        wf::region_t stale{wlr_box{0, 0, src_box.width, src_box.height}};
+        stale ^= fresh;
+        stale ^= opaque + origin;
+
+        stale.expand_edges(padding);
+
+        /* pre_render() overwrites the whole extents of the blurred region */
+        valid ^= wlr_box_from_pixman_box(fresh.get_extents());
+        valid |= fresh ^ stale;
+    }
+};
+
 using blur_algorithm_provider = std::function<nonstd::observer_ptr<wf_blur_base>()>;
 class wf_blur_transformer : public wf::view_transformer_t
 {
@@ -15,6 +88,8 @@ class wf_blur_transformer : public wf::view_transformer_t
     wf::output_t *output;
     wayfire_view view;
 
+    blur_cache_t cache;
+
   public:
     wf_blur_transformer(blur_algorithm_provider blur_algorithm_provider,
         wf::output_t *output, wayfire_view view)
@@ -24,6 +99,24 @@ class wf_blur_transformer : public wf::view_transformer_t
         this->view   = view;
     }
 
+    ~wf_blur_transformer()
+    {
+        OpenGL::render_begin();
+        cache.fb.release();
+        OpenGL::render_end();
+    }
+
+    /**
+     * Called before each frame with the damage which changes the background
+     * behind the view, before it is expanded by the blur radius.
+     */
+    void frame_damaged(const wf::region_t& behind, int padding)
+    {
+        wf::region_t expanded = behind;
+        expanded.expand_edges(padding);
+        cache.invalidate(expanded);
+    }
+
     wf::pointf_t transform_point(wf::geometry_t view,
         wf::pointf_t point) override
     {
@@ -66,27 +159,67 @@ class wf_blur_transformer : public wf::view_transformer_t
         OpenGL::render_end();
     }
 
-    void render_with_damage(wf::texture_t src_tex, wlr_box src_box,
-        const wf::region_t& damage, const wf::framebuffer_t& target_fb) override
+    /**
+     * Check whether the opaque region completely occludes the bounding box.
+     * If this is the case, we can skip blurring altogether and just render
+     * the surface.
+     */
+    bool is_fully_opaque(wlr_box src_box)
     {
-        wf::region_t clip_damage = damage & src_box;
-
-        /* We want to check if the opaque region completely occludes
-         * the bounding box. If this is the case, we can skip blurring
-         * altogether and just render the surface. First we disable
-         * shrinking and get the opaque region without padding */
+        /* First we disable shrinking and get the opaque region without
+         * padding */
         wf::surface_interface_t::set_opaque_shrink_constraint("blur", 0);
         wf::region_t full_opaque = view->get_transformed_opaque_region();
 
         /* Shrink the opaque region by the padding amount since the render
          * chain expects this, as we have applied padding to damage in
          * frame_pre_paint for this frame already */
-        int padding = std::ceil(provider()->calculate_blur_radius() /
-            output->render->get_target_framebuffer().scale);
-        wf::surface_interface_t::set_opaque_shrink_constraint("blur", padding);
+        wf::surface_interface_t::set_opaque_shrink_constraint("blur",
+            get_padding());
 
         wf::region_t bbox_region{src_box};
-        if ((bbox_region ^ full_opaque).empty())
+
+        return (bbox_region ^ full_opaque).empty();
+    }
+
+    int get_padding()
+    {
+        return std::ceil(provider()->calculate_blur_radius() /
+            output->render->get_target_framebuffer().scale);
+    }
+
+    /**
+     * Prepare rendering the view with the given damage, for scheduling the
+     * shared background.
+     *
+     * @return The region which will be blurred, or an empty region if the
+     *   cached background can be used.
+     */
+    wf::region_t get_region_to_blur(const wf::region_t& damage,
+        const wf::framebuffer_t& target_fb)
+    {
+        auto src_box = view->get_bounding_box();
+        if (is_fully_opaque(src_box))
+        {
+            return {};
+        }
+
+        wf::region_t blurred_region =
+            (damage & src_box) ^ view->get_transformed_opaque_region();
+        cache.set_box(src_box, target_fb.framebuffer_box_from_geometry_box(src_box));
+
+        return cache.covers(blurred_region) ? wf::region_t{} : blurred_region;
+    }
+
+    /* The parts of the view whose background is taken from the shared
+     * background, see wf_blur_base::schedule_shared() */
+    wf::region_t shared_region;
+
+    void render_with_damage(wf::texture_t src_tex, wlr_box src_box,
+        const wf::region_t& damage, const wf::framebuffer_t& target_fb) override
+    {
+        wf::region_t clip_damage = damage & src_box;
+        if (is_fully_opaque(src_box))
         {
             /* In case the whole surface is opaque, we can simply skip blurring */
             direct_render(src_tex, src_box, damage, target_fb);
@@ -97,7 +230,14 @@ class wf_blur_transformer : public wf::view_transformer_t
         wf::region_t opaque_region  = view->get_transformed_opaque_region();
         wf::region_t blurred_region = clip_damage ^ opaque_region;
 
-        provider()->pre_render(src_tex, src_box, blurred_region, target_fb);
+        cache.set_box(src_box, target_fb.framebuffer_box_from_geometry_box(src_box));
+        if (!cache.covers(blurred_region))
+        {
+            provider()->pre_render(src_tex, src_box, blurred_region, target_fb,
+                cache.fb, shared_region);
+            cache.update(blurred_region, opaque_region, get_padding());
+        }
+
         wf::view_transformer_t::render_with_damage(src_tex, src_box, blurred_region,
             target_fb);
 
@@ -108,7 +248,7 @@ class wf_blur_transformer : public wf::view_transformer_t
     void render_box(wf::texture_t src_tex, wlr_box src_box, wlr_box scissor_box,
         const wf::framebuffer_t& target_fb) override
     {
-        provider()->render(src_tex, src_box, scissor_box, target_fb);
+        provider()->render(src_tex, src_box, scissor_box, target_fb, cache.fb);
     }
 };
 
@@ -135,6 +275,87 @@ class wayfire_blur : public wf::plugin_interface_t
     wf::framebuffer_base_t saved_pixels;
     wf::region_t padded_region;
 
+    /* The damage each view on the output reported since the last frame */
+    std::map<wayfire_view, wf::region_t> views_damage;
+    wf::signal_connection_t on_view_damaged = {[=] (wf::signal_data_t *data)
+        {
+            auto ev = static_cast<wf::view_region_damaged_signal*>(data);
+            views_damage[ev->view] |= ev->box;
+        }
+    };
+
+    void track_view_damage(wayfire_view view)
+    {
+        /* Views are attached and then mapped, connect only once */
+        view->disconnect_signal(&on_view_damaged);
+        view->connect_signal("region-damaged", &on_view_damaged);
+    }
+
+    /* Set when views were restacked or left the output since the last frame.
+     * Their damage cannot be attributed to a position in the stack then. */
+    bool stacking_changed = false;
+    wf::signal_connection_t on_stacking_changed = {[=] (wf::signal_data_t*)
+        {
+            stacking_changed = true;
+        }
+    };
+
+    /**
+     * Invalidate the cached backgrounds of the blurred views where the views
+     * below them have changed. Damage which was not reported by a view in the
+     * current stack, for example when the whole output is damaged or when the
+     * damaged view is already gone, is treated as coming from below all views.
+     * After a restack, all damage is treated like this.
+     */
+    void invalidate_backgrounds(const wf::region_t& damage, int padding)
+    {
+        /* The views from bottom to top */
+        std::vector<wayfire_view> stack;
+        auto views = output->workspace->get_views_in_layer_snapshot(
+            wf::ALL_LAYERS);
+        for (auto& v : wf::reverse(views))
+        {
+            auto children = v->enumerate_views(false);
+            for (auto& view : wf::reverse(children))
+            {
+                stack.push_back(view);
+            }
+        }
+
+        wf::region_t below = damage;
+        if (!stacking_changed)
+        {
+            wf::region_t reported;
+            for (auto& view : stack)
+            {
+                auto it = views_damage.find(view);
+                if (it != views_damage.end())
+                {
+                    reported |= it->second;
+                }
+            }
+
+            below ^= reported;
+        }
+
+        for (auto& view : stack)
+        {
+            if (auto tr = get_blur_transformer(view))
+            {
+                tr->frame_damaged(below, padding);
+            }
+
+            auto it = views_damage.find(view);
+            if (it != views_damage.end())
+            {
+                below |= it->second;
+            }
+        }
+
+        views_damage.clear();
+        stacking_changed = false;
+    }
+
     void add_transformer(wayfire_view view)
     {
         if (view->get_transformer(transformer_name))
@@ -164,6 +385,98 @@ class wayfire_blur : public wf::plugin_interface_t
         }
     }
 
+    /** @return The blur transformer of the view, or nullptr if it has none */
+    wf_blur_transformer *get_blur_transformer(wayfire_view view)
+    {
+        return static_cast<wf_blur_transformer*>(
+            view->get_transformer(transformer_name).get());
+    }
+
+    /**
+     * Find the parts of the blurred views on the workspace stream which show
+     * the same background as the bottommost view which needs blurring, and
+     * schedule blurring them only once for all of these views.
+     *
+     * The shared background is blurred before the views above the bottommost
+     * one are rendered, so a part of a view can use it only if it is farther
+     * than the blur radius from these views.
+     */
+    void schedule_shared_blur(wf::point_t ws, const wf::region_t& damage,
+        const wf::framebuffer_t& target_fb)
+    {
+        int padding = std::ceil(
+            blur_algorithm->calculate_blur_radius() / target_fb.scale);
+
+        auto og  = output->get_relative_geometry();
+        auto cws = output->workspace->get_current_workspace();
+        wf::point_t ws_delta{(ws.x - cws.x) * og.width, (ws.y - cws.y) * og.height};
+
+        /* The shared background is blurred from the whole framebuffer, and
+         * not only from the damage of each view, so it cannot be used close to
+         * the pixels which are not repainted in this frame */
+        wf::region_t unpainted =
+            wf::region_t{output->render->get_ws_box(ws)} ^ damage;
+        unpainted.expand_edges(padding);
+
+        wf::region_t shared;
+        /* The views from the bottommost blurred view up to the current one */
+        wf::region_t above;
+        bool found_blurred = false;
+
+        auto views = output->workspace->get_views_on_workspace_snapshot(ws,
+            wf::VISIBLE_LAYERS);
+        for (auto& v : wf::reverse(views))
+        {
+            auto children = v->enumerate_views(false);
+            for (auto& view : wf::reverse(children))
+            {
+                auto tr = get_blur_transformer(view);
+                if (tr)
+                {
+                    tr->shared_region.clear();
+                }
+
+                if (!view->is_visible())
+                {
+                    continue;
+                }
+
+                /* Shell views are rendered with an offset on the other
+                 * workspaces, they always blur their own background */
+                auto bbox    = view->get_bounding_box();
+                bool shifted = (view->role == wf::VIEW_ROLE_DESKTOP_ENVIRONMENT) &&
+                    (ws != cws);
+                if (shifted)
+                {
+                    bbox = bbox + ws_delta;
+                }
+
+                wf::region_t region;
+                if (tr && !shifted)
+                {
+                    region = tr->get_region_to_blur(damage, target_fb);
+                }
+
+                if (!region.empty())
+                {
+                    wf::region_t blocked = above;
+                    blocked.expand_edges(padding);
+                    tr->shared_region = region ^ blocked ^ unpainted;
+                    shared |= tr->shared_region;
+                    found_blurred = true;
+                }
+
+                if (found_blurred)
+                {
+                    above |= bbox;
+                }
+            }
+        }
+
+        blur_algorithm->schedule_shared(get_fb_region(shared, target_fb),
+            target_fb);
+    }
+
     /** Transform region into framebuffer coordinates */
     wf::region_t get_fb_region(const wf::region_t& region,
         const wf::framebuffer_t& fb) const
@@ -258,6 +571,8 @@ class wayfire_blur : public wf::plugin_interface_t
         view_attached = [=] (wf::signal_data_t *data)
         {
             auto view = get_signaled_view(data);
+            track_view_damage(view);
+
             /* View was just created -> we don't know its layer yet */
             if (!view->is_mapped())
             {
@@ -280,8 +595,23 @@ class wayfire_blur : public wf::plugin_interface_t
         view_detached = [=] (wf::signal_data_t *data)
         {
             auto view = get_signaled_view(data);
+            view->disconnect_signal(&on_view_damaged);
             pop_transformer(view);
         };
+        for (auto& view : output->workspace->get_views_in_layer(wf::ALL_LAYERS))
+        {
+            for (auto& child : view->enumerate_views(false))
+            {
+                track_view_damage(child);
+            }
+        }
+
+        for (auto signal : {"stack-order-changed", "view-layer-detached",
+                            "view-disappeared"})
+        {
+            output->connect_signal(signal, &on_stacking_changed);
+        }
+
         output->connect_signal("view-attached", &view_attached);
         output->connect_signal("view-mapped", &view_attached);
         output->connect_signal("view-detached", &view_detached);
@@ -301,6 +631,8 @@ class wayfire_blur : public wf::plugin_interface_t
             wf::surface_interface_t::set_opaque_shrink_constraint("blur",
                 padding);
 
+            invalidate_backgrounds(damage, padding);
+
             wf::region_t padded;
             for (const auto& rect : damage)
             {
@@ -379,6 +711,8 @@ class wayfire_blur : public wf::plugin_interface_t
             damage |= expanded_damage;
             GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
             OpenGL::render_end();
+
+            schedule_shared_blur(ws, damage, target_fb);
         };
 
         output->render->connect_signal("workspace-stream-pre",
@@ -409,6 +743,7 @@ class wayfire_blur : public wf::plugin_interface_t
 
             /* Reset stuff */
             padded_region.clear();
+            blur_algorithm->clear_shared();
             GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
             OpenGL::render_end();
         };
@@ -426,6 +761,8 @@ class wayfire_blur : public wf::plugin_interface_t
         output->disconnect_signal("view-mapped", &view_attached);
         output->disconnect_signal("view-detached", &view_detached);
         output->render->rem_effect(&frame_pre_paint);
+        on_view_damaged.disconnect();
+        on_stacking_changed.disconnect();
         output->render->disconnect_signal("workspace-stream-pre",
             &workspace_stream_pre);
         output->render->disconnect_signal("workspace-stream-post",
@@ -113,11 +113,45 @@ class wf_blur_base
         wf::framebuffer_base_t& in, wf::framebuffer_base_t& out,
         int width, int height);
 
-    /* copy the source pixels from region, storing into result
+    /* copy the source pixels from region, which is in framebuffer coords,
+     * storing into result
      * returns the result geometry, in framebuffer coords */
     wlr_box copy_region(wf::framebuffer_base_t& result,
         const wf::framebuffer_t& source, const wf::region_t& region);
 
+    /* the size of the blurred image of box, after scaling down by degrade */
+    wf::dimensions_t get_scaled_size(wlr_box box);
+
+    /* copy and blur the source pixels from region, which is in framebuffer
+     * coords. The result is stored scaled down in fb[0]
+     * returns the blurred box, in framebuffer coords */
+    wlr_box blur_region(const wf::framebuffer_t& source,
+        const wf::region_t& region);
+
+    /* blit the blurred image of blurred_box to its place in result, which
+     * has the size of view_box. If clip is given, only the parts of the
+     * image inside it are copied. All boxes are in framebuffer coords */
+    void blit_blurred(const wf::framebuffer_base_t& blurred,
+        wlr_box blurred_box, wlr_box view_box, wf::framebuffer_base_t& result,
+        const wf::region_t *clip);
+
+    /* The background blurred once per workspace stream for all blurred views
+     * on it, see schedule_shared() */
+    enum shared_state_t
+    {
+        SHARED_NONE,
+        SHARED_PENDING,
+        SHARED_DONE,
+    };
+
+    shared_state_t shared_state = SHARED_NONE;
+    /* the region to blur and the resulting box, in framebuffer coords */
+    wf::region_t shared_region;
+    wlr_box shared_box = {0, 0, 0, 0};
+    /* the framebuffer from which the shared background is blurred */
+    uint32_t shared_target = 0;
+    wf::framebuffer_base_t shared_fb;
+
     /* blur fb[0]
      * width and height are the scaled dimensions of the buffer
      * returns the index of the fb where the result is stored (0 or 1) */
@@ -129,11 +163,29 @@ class wf_blur_base
 
     virtual int calculate_blur_radius();
 
+    /* blur the background in damage, and store it in result, which has the
+     * size of src_box in target_fb. Parts of result outside of the extents of
+     * damage are left untouched, so that they can be reused.
+     *
+     * The parts of damage inside shared are taken from the shared background,
+     * if one was scheduled for target_fb */
     virtual void pre_render(wf::texture_t src_tex, wlr_box src_box,
-        const wf::region_t& damage, const wf::framebuffer_t& target_fb);
+        const wf::region_t& damage, const wf::framebuffer_t& target_fb,
+        wf::framebuffer_base_t& result, const wf::region_t& shared);
+
+    /* Blur region of target_fb, in framebuffer coords, only once for all views
+     * which see the same background there. It is blurred when the first view
+     * which needs it is rendered, which must be the bottommost of them */
+    void schedule_shared(const wf::region_t& region,
+        const wf::framebuffer_t& target_fb);
+
+    /* Drop the shared background at the end of the workspace stream */
+    void clear_shared();
 
+    /* blend the blurred background from pre_render() with src_tex */
     virtual void render(wf::texture_t src_tex, wlr_box src_box,
-        wlr_box scissor_box, const wf::framebuffer_t& target_fb);
+        wlr_box scissor_box, const wf::framebuffer_t& target_fb,
+        const wf::framebuffer_base_t& blurred);
 };
 
 std::unique_ptr<wf_blur_base> create_box_blur(wf::output_t *output);
@@ -8,6 +8,7 @@
 #include <wayfire/workspace-manager.hpp>
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
 
 namespace wf
 {
@@ -58,6 +59,11 @@ class workspace_wall_t : public wf::signal_provider_t
         {
             for (auto& stream : row)
             {
+                if (stream.running)
+                {
+                    output->render->workspace_stream_stop(stream);
+                }
+
                 stream.buffer.release();
             }
         }
@@ -127,7 +133,7 @@ class workspace_wall_t : public wf::signal_provider_t
      */
     void render_wall(const wf::framebuffer_t& fb, wf::geometry_t geometry)
     {
-        update_streams();
+        update_streams(get_stream_scale(geometry));
 
         OpenGL::render_begin(fb);
         fb.logic_scissor(geometry);
@@ -227,17 +233,37 @@ class workspace_wall_t : public wf::signal_provider_t
 
     wf::geometry_t viewport = {0, 0, 0, 0};
     std::vector<std::vector<wf::workspace_stream_t>> streams;
-    /** Update or start visible streams */
-    void update_streams()
+    /**
+     * Calculate the scale at which the workspaces are shown when the viewport
+     * is rendered to the given rectangle. It is rounded up to a multiple of
+     * 1/8, so that animating the viewport does not resize the streams on every
+     * frame.
+     */
+    float get_stream_scale(wf::geometry_t geometry) const
+    {
+        if ((viewport.width <= 0) || (viewport.height <= 0))
+        {
+            return 1;
+        }
+
+        double scale = std::max(geometry.width * 1.0 / viewport.width,
+            geometry.height * 1.0 / viewport.height);
+
+        return std::min(1.0, std::ceil(scale * 8) / 8);
+    }
+
+    /** Update or start visible streams, rendering them at the given scale */
+    void update_streams(float scale)
     {
         for (auto& ws : get_visible_workspaces(viewport))
         {
             auto& stream = streams[ws.x][ws.y];
             if (stream.running)
             {
-                output->render->workspace_stream_update(stream);
+                output->render->workspace_stream_update(stream, scale, scale);
             } else
             {
+                stream.scale_x = stream.scale_y = scale;
                 output->render->workspace_stream_start(stream);
             }
         }
@@ -153,6 +153,20 @@ class simple_decoration_surface : public wf::surface_interface_t,
         }
     }
 
+    wf::region_t get_opaque_region(wf::point_t origin) override
+    {
+        /* Title and buttons are drawn on top of the background */
+        if (!theme.is_background_opaque(active))
+        {
+            return {};
+        }
+
+        wf::region_t opaque = this->cached_region + origin;
+        opaque.expand_edges(-get_active_shrink_constraint());
+
+        return opaque;
+    }
+
     bool accepts_input(int32_t sx, int32_t sy) override
     {
         return pixman_region32_contains_point(cached_region.to_pixman(),
@@ -50,6 +50,13 @@ void decoration_theme_t::render_background(const wf::framebuffer_t& fb,
     OpenGL::render_end();
 }
 
+bool decoration_theme_t::is_background_opaque(bool active) const
+{
+    wf::color_t color = active ? active_color : inactive_color;
+
+    return color.a >= 1.0;
+}
+
 /**
  * Render the given text on a cairo_surface_t with the given size.
  * The caller is responsible for freeing the memory afterwards.
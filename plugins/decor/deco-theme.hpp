@@ -32,6 +32,9 @@ class decoration_theme_t
     void render_background(const wf::framebuffer_t& fb, wf::geometry_t rectangle,
         const wf::geometry_t& scissor, bool active) const;
 
+    /** @return Whether the background drawn by render_background() is opaque */
+    bool is_background_opaque(bool active) const;
+
     /**
      * Render the given text on a cairo_surface_t with the given size.
      * The caller is responsible for freeing the memory afterwards.
@@ -0,0 +1,550 @@
+#include <wayfire/plugin.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/core.hpp>
+#include <wayfire/compositor-view.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/util/log.hpp>
+#include <wayfire/bench-counters.hpp>
+#include "../animate/fire/particle.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+/**
+ * A benchmark for the damage tracking and repaint path.
+ *
+ * The plugin fills the output with synthetic color views, damages the output
+ * with the configured pattern on every frame, and reports how long the frames
+ * took once the configured number of frames has been repainted.
+ *
+ * It is meant to be run as the only plugin in the wayfire-bench harness, see
+ * the run-bench target. The frame timings come from the render manager, so
+ * core/frame_timing_history must be enabled. The harness also counts memory
+ * allocations and region operations, which are reported per frame.
+ *
+ * With bench/particles, a fire particle system of that size is also updated
+ * and rendered on every frame, and the time it takes is reported.
+ *
+ * The report also contains microbenchmarks of the wf::region_t operations
+ * which are common in the repaint path, compared to the equivalent pixman
+ * calls which region_t used to make for all regions.
+ */
+class wayfire_bench : public wf::plugin_interface_t
+{
+    wf::option_wrapper_t<int> num_views{"bench/views"};
+    wf::option_wrapper_t<int> view_width{"bench/view_width"};
+    wf::option_wrapper_t<int> view_height{"bench/view_height"};
+    wf::option_wrapper_t<double> view_alpha{"bench/view_alpha"};
+    wf::option_wrapper_t<std::string> damage_pattern{"bench/damage"};
+    wf::option_wrapper_t<int> num_frames{"bench/frames"};
+    wf::option_wrapper_t<std::string> report_file{"bench/report_file"};
+    wf::option_wrapper_t<bool> exit_when_done{"bench/exit_when_done"};
+    wf::option_wrapper_t<int> region_iterations{"bench/region_iterations"};
+    wf::option_wrapper_t<int> num_particles{"bench/particles"};
+
+    std::vector<nonstd::observer_ptr<wf::color_rect_view_t>> views;
+    std::minstd_rand random_engine;
+
+    struct frame_sample_t
+    {
+        wf::frame_timing_t timing;
+        /* The number of rectangles in the swap damage */
+        int damage_rects;
+        /* The time spent updating and rendering particles, in us */
+        int64_t particles;
+        /* The allocations and region operations since the previous frame */
+        wf::bench::counters_t counters;
+    };
+
+    /** @return The current harness counters, or zeros outside of the harness */
+    static wf::bench::counters_t get_counters()
+    {
+        return wf::bench::get_counters ? wf::bench::get_counters() :
+               wf::bench::counters_t{};
+    }
+
+    /* The counters at the end of the previous frame */
+    wf::bench::counters_t last_counters;
+
+    std::vector<frame_sample_t> samples;
+    int last_damage_rects = 0;
+    int64_t last_particles = 0;
+
+    std::unique_ptr<ParticleSystem> particles;
+    bool done = false;
+
+  public:
+    void init() override
+    {
+        grab_interface->name = "bench";
+        grab_interface->capabilities = 0;
+
+        create_views();
+        /* Do not count the allocations of the plugin itself */
+        samples.reserve(std::max(0, (int)num_frames));
+        last_counters = get_counters();
+        if (num_particles > 0)
+        {
+            particles = std::make_unique<ParticleSystem>(num_particles,
+                [og = output->get_relative_geometry()] (Particle& p)
+            {
+                init_particle(p, og);
+            });
+            output->render->add_effect(&render_particles,
+                wf::OUTPUT_EFFECT_OVERLAY);
+        }
+
+        output->render->add_effect(&apply_damage, wf::OUTPUT_EFFECT_PRE);
+        output->render->add_effect(&count_damage, wf::OUTPUT_EFFECT_OVERLAY);
+        output->render->connect_signal("frame-timing", &on_frame_timing);
+        output->render->set_redraw_always();
+
+        LOGI("bench: rendering ", (int)num_frames, " frames with ",
+            (int)num_views, " views and damage pattern ",
+            (std::string)damage_pattern);
+    }
+
+    void create_views()
+    {
+        auto og = output->get_relative_geometry();
+        int w   = std::min((int)view_width, og.width);
+        int h   = std::min((int)view_height, og.height);
+
+        for (int i = 0; i < num_views; i++)
+        {
+            auto view = new wf::color_rect_view_t();
+            wf::get_core().add_view(std::unique_ptr<wf::view_interface_t>(view));
+            view->set_output(output);
+            output->workspace->add_view(view->self(), wf::LAYER_WORKSPACE);
+
+            /* Cascade the views, so that they overlap partially */
+            int x = (i * 37) % std::max(1, og.width - w);
+            int y = (i * 23) % std::max(1, og.height - h);
+            view->set_geometry({x, y, w, h});
+            view->set_color({(i % 3) / 2.0, ((i + 1) % 3) / 2.0,
+                ((i + 2) % 3) / 2.0, view_alpha});
+
+            views.push_back(nonstd::make_observer(view));
+        }
+    }
+
+    wf::effect_hook_t apply_damage = [=] ()
+    {
+        const std::string pattern = damage_pattern;
+        if (pattern == "full")
+        {
+            output->render->damage_whole();
+        } else if (pattern == "views")
+        {
+            for (auto& view : views)
+            {
+                view->damage();
+            }
+        } else if (pattern == "single")
+        {
+            if (!views.empty())
+            {
+                views[samples.size() % views.size()]->damage();
+            }
+        } else if (pattern == "move")
+        {
+            auto og = output->get_relative_geometry();
+            for (auto& view : views)
+            {
+                auto g = view->get_wm_geometry();
+                g.x = (g.x + 1 + random_engine() % 3) % std::max(1,
+                    og.width - g.width);
+                view->set_geometry(g);
+            }
+        }
+
+        /* "none" repaints only what the views damage themselves */
+    };
+
+    /** Initialize a particle like the fire animation does, on the whole output.
+     * Called from multiple threads. */
+    static void init_particle(Particle& p, wf::geometry_t og)
+    {
+        static thread_local std::minstd_rand generator;
+        auto random = [&] (float s, float e)
+        {
+            return std::uniform_real_distribution<float>{s, e}(generator);
+        };
+
+        p.life = 1;
+        p.fade = random(0.1, 0.6);
+        p.color = {random(0.4, 1), random(0.08, 0.2), random(0.008, 0.018), 1};
+        p.pos   = {random(0, og.width), random(0, og.height)};
+        p.start_pos   = p.pos;
+        p.speed = {random(-10, 10), random(-25, 5)};
+        p.g     = {-1, -3};
+        p.base_radius = p.radius = random(12, 18);
+    }
+
+    wf::effect_hook_t render_particles = [=] ()
+    {
+        auto start = std::chrono::steady_clock::now();
+        particles->spawn(particles->size());
+        particles->update();
+
+        auto fb = output->render->get_target_framebuffer();
+        OpenGL::render_begin(fb);
+        particles->render(fb.get_orthographic_projection());
+        OpenGL::render_end();
+
+        last_particles = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+
+    wf::effect_hook_t count_damage = [=] ()
+    {
+        auto damage = output->render->get_swap_damage();
+        last_damage_rects = damage.end() - damage.begin();
+    };
+
+    wf::signal_connection_t on_frame_timing = {[=] (wf::signal_data_t *data)
+        {
+            auto ev = static_cast<wf::frame_timing_signal*>(data);
+            if (done)
+            {
+                return;
+            }
+
+            auto counters = get_counters();
+            samples.push_back({*ev->timing, last_damage_rects, last_particles, {
+                counters.allocations - last_counters.allocations,
+                counters.region_ops - last_counters.region_ops}});
+            last_counters = counters;
+            if ((int)samples.size() >= num_frames)
+            {
+                finish();
+            }
+        }
+    };
+
+    /** @return The given percentile of the values */
+    static int64_t percentile(std::vector<int64_t> values, double p)
+    {
+        if (values.empty())
+        {
+            return 0;
+        }
+
+        size_t idx = std::min(values.size() - 1, (size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + idx, values.end());
+
+        return values[idx];
+    }
+
+    static void report_line(std::ostream& out, const std::string& name,
+        const std::vector<int64_t>& values)
+    {
+        int64_t sum = 0;
+        for (auto v : values)
+        {
+            sum += v;
+        }
+
+        out << name << ": avg=" << (values.empty() ? 0 : sum / values.size()) <<
+            " p50=" << percentile(values, 0.5) <<
+            " p99=" << percentile(values, 0.99) <<
+            " max=" << percentile(values, 1.0) << "\n";
+    }
+
+    void write_report(std::ostream& out)
+    {
+        static const char *phase_names[] = {
+            "pre", "render", "overlay", "sw_cursors", "post_effects", "swap",
+            "post",
+        };
+
+        out << "# bench: " << samples.size() << " frames, " << views.size() <<
+            " views of " << (int)view_width << "x" << (int)view_height <<
+            ", alpha " << (double)view_alpha << ", damage " <<
+            (std::string)damage_pattern << ", " <<
+            std::max(0, (int)num_particles) << " particles, durations in us\n";
+
+        std::vector<int64_t> values;
+        for (auto& sample : samples)
+        {
+            values.push_back(sample.timing.total);
+        }
+
+        report_line(out, "total", values);
+        for (int i = 0; i < wf::FRAME_PHASE_TOTAL; i++)
+        {
+            values.clear();
+            for (auto& sample : samples)
+            {
+                values.push_back(sample.timing.phases[i]);
+            }
+
+            report_line(out, phase_names[i], values);
+        }
+
+        values.clear();
+        for (auto& sample : samples)
+        {
+            values.push_back(sample.damage_rects);
+        }
+
+        report_line(out, "damage_rects", values);
+        if (particles)
+        {
+            values.clear();
+            for (auto& sample : samples)
+            {
+                values.push_back(sample.particles);
+            }
+
+            report_line(out, "particles", values);
+        }
+
+        if (wf::bench::get_counters)
+        {
+            values.clear();
+            for (auto& sample : samples)
+            {
+                values.push_back(sample.counters.allocations);
+            }
+
+            report_line(out, "allocations", values);
+            values.clear();
+            for (auto& sample : samples)
+            {
+                values.push_back(sample.counters.region_ops);
+            }
+
+            report_line(out, "region_ops", values);
+        }
+
+        out << "# per frame: total";
+        for (auto& name : phase_names)
+        {
+            out << " " << name;
+        }
+
+        out << " damage_rects allocations region_ops\n";
+        for (auto& sample : samples)
+        {
+            out << sample.timing.total;
+            for (auto& phase : sample.timing.phases)
+            {
+                out << " " << phase;
+            }
+
+            out << " " << sample.damage_rects << " " <<
+                sample.counters.allocations << " " <<
+                sample.counters.region_ops << "\n";
+        }
+    }
+
+    /* Results of the region operations, so that they are not optimized out */
+    int64_t region_checksum = 0;
+
+    /** @return The average duration of op in nanoseconds */
+    template<class Op>
+    double time_region_op(Op op)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < region_iterations; i++)
+        {
+            op(i);
+        }
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        return 1.0 * ns / region_iterations;
+    }
+
+    static void region_line(std::ostream& out, const std::string& name,
+        double pixman, double region)
+    {
+        out << name << ": pixman=" << std::fixed << std::setprecision(1) <<
+            pixman << " region_t=" << region << "\n";
+    }
+
+    void write_region_report(std::ostream& out)
+    {
+        if (region_iterations <= 0)
+        {
+            return;
+        }
+
+        out << "# region ops: " << (int)region_iterations <<
+            " iterations, durations in ns\n";
+
+        const wlr_box box = {100, 100, 400, 300};
+        const wlr_box inside = {150, 150, 100, 100};
+        const wlr_box cover  = {0, 0, 1920, 1080};
+        const wlr_box disjoint = {1000, 1000, 50, 50};
+        wf::region_t single{box};
+        wf::region_t fragmented;
+        for (int i = 0; i < 8; i++)
+        {
+            fragmented |= wlr_box{i * 60, i * 40, 50, 30};
+        }
+
+        auto sum = [] (const pixman_region32_t *region)
+        {
+            return (int64_t)region->extents.x1 + region->extents.y2;
+        };
+
+        /* Copy a single box, as done for per-surface damage */
+        region_line(out, "copy", time_region_op([&] (int)
+        {
+            pixman_region32_t copy;
+            pixman_region32_init(&copy);
+            pixman_region32_copy(&copy, single.to_pixman());
+            region_checksum += sum(&copy);
+            pixman_region32_fini(&copy);
+        }), time_region_op([&] (int)
+        {
+            wf::region_t copy{single};
+            region_checksum += sum(copy.to_pixman());
+        }));
+
+        region_line(out, "copy_8_boxes", time_region_op([&] (int)
+        {
+            pixman_region32_t copy;
+            pixman_region32_init(&copy);
+            pixman_region32_copy(&copy, fragmented.to_pixman());
+            region_checksum += sum(&copy);
+            pixman_region32_fini(&copy);
+        }), time_region_op([&] (int)
+        {
+            wf::region_t copy{fragmented};
+            region_checksum += sum(copy.to_pixman());
+        }));
+
+        /* Clip damage to the bounds of a surface */
+        region_line(out, "intersect_box", time_region_op([&] (int i)
+        {
+            pixman_region32_t result;
+            pixman_region32_init(&result);
+            pixman_region32_intersect_rect(&result, single.to_pixman(),
+                inside.x + i % 7, inside.y, inside.width, inside.height);
+            region_checksum += sum(&result);
+            pixman_region32_fini(&result);
+        }), time_region_op([&] (int i)
+        {
+            auto result = single & wlr_box{inside.x + i % 7, inside.y,
+                inside.width, inside.height};
+            region_checksum += sum(result.to_pixman());
+        }));
+
+        /* Subtract an opaque region from damage, see schedule_surface() */
+        auto subtract = [&] (const std::string& name, const wlr_box& sub)
+        {
+            region_line(out, "subtract_" + name, time_region_op([&] (int)
+            {
+                pixman_region32_t result, sub_region;
+                pixman_region32_init(&result);
+                pixman_region32_copy(&result, single.to_pixman());
+                pixman_region32_init_rect(&sub_region,
+                    sub.x, sub.y, sub.width, sub.height);
+                pixman_region32_subtract(&result, &result, &sub_region);
+                region_checksum += sum(&result);
+                pixman_region32_fini(&sub_region);
+                pixman_region32_fini(&result);
+            }), time_region_op([&] (int)
+            {
+                wf::region_t result{single};
+                result ^= sub;
+                region_checksum += sum(result.to_pixman());
+            }));
+        };
+
+        subtract("cover", cover);
+        subtract("inside", inside);
+        subtract("disjoint", disjoint);
+
+        /* Move damage to output-local coordinates */
+        region_line(out, "translate", time_region_op([&] (int i)
+        {
+            pixman_region32_t result;
+            pixman_region32_init(&result);
+            pixman_region32_copy(&result, single.to_pixman());
+            pixman_region32_translate(&result, i % 5, i % 3);
+            region_checksum += sum(&result);
+            pixman_region32_fini(&result);
+        }), time_region_op([&] (int i)
+        {
+            auto result = single + wf::point_t{i % 5, i % 3};
+            region_checksum += sum(result.to_pixman());
+        }));
+
+        /* Accumulate damage of a single box */
+        region_line(out, "union_box", time_region_op([&] (int i)
+        {
+            pixman_region32_t result;
+            pixman_region32_init(&result);
+            pixman_region32_union_rect(&result, &result,
+                box.x + i % 7, box.y, box.width, box.height);
+            region_checksum += sum(&result);
+            pixman_region32_fini(&result);
+        }), time_region_op([&] (int i)
+        {
+            wf::region_t result;
+            result |= wlr_box{box.x + i % 7, box.y, box.width, box.height};
+            region_checksum += sum(result.to_pixman());
+        }));
+
+        out << "# region checksum " << region_checksum << "\n";
+    }
+
+    void finish()
+    {
+        done = true;
+        output->render->set_redraw_always(false);
+
+        std::ostringstream report;
+        write_report(report);
+        write_region_report(report);
+
+        const std::string file = report_file;
+        if (file.empty())
+        {
+            LOGI(report.str());
+        } else
+        {
+            std::ofstream out{file};
+            out << report.str();
+            LOGI("bench: report written to ", file);
+        }
+
+        if (exit_when_done)
+        {
+            wf::get_core().shutdown();
+        }
+    }
+
+    void fini() override
+    {
+        if (!done)
+        {
+            output->render->set_redraw_always(false);
+        }
+
+        output->render->rem_effect(&apply_damage);
+        output->render->rem_effect(&count_damage);
+        if (particles)
+        {
+            output->render->rem_effect(&render_particles);
+            particles.reset();
+        }
+
+        for (auto& view : views)
+        {
+            view->close();
+        }
+    }
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_bench);
@@ -28,47 +28,30 @@
 #include <wayfire/util/duration.hpp>
 #include <wayfire/render-manager.hpp>
 
-static const char *vertex_shader =
+static const char *fisheye_source =
     R"(
-#version 100
+uniform highp vec2 @name@_mouse;
+uniform highp float @name@_radius;
+uniform highp float @name@_zoom;
 
-attribute mediump vec2 position;
-
-void main() {
-
-    gl_Position = vec4(position.xy, 0.0, 1.0);
-}
-)";
-
-static const char *fragment_shader =
-    R"(
-#version 100
-precision mediump float;
-
-uniform vec2 u_resolution;
-uniform vec2 u_mouse;
-uniform float u_radius;
-uniform float u_zoom;
-uniform sampler2D u_texture;
-
-const float PI = 3.1415926535;
-
-void main()
+highp vec2 @name@(highp vec2 uv_in)
 {
-        float radius = u_radius;
+        const highp float PI = 3.1415926535;
 
-        float zoom = u_zoom;
-        float pw = 1.0 / u_resolution.x;
-        float ph = 1.0 / u_resolution.y;
+        highp float radius = @name@_radius;
 
-        vec4 p0 = vec4(u_mouse.x, u_resolution.y - u_mouse.y, 1.0 / radius, 0.0);
-        vec4 p1 = vec4(pw, ph, PI / radius, (zoom - 1.0) * zoom);
-        vec4 p2 = vec4(0, 0, -PI / 2.0, 0.0);
+        highp float zoom = @name@_zoom;
+        highp float pw = 1.0 / wf_resolution.x;
+        highp float ph = 1.0 / wf_resolution.y;
 
-        vec4 t0, t1, t2, t3;
+        highp vec4 p0 = vec4(@name@_mouse.x, wf_resolution.y - @name@_mouse.y,
+            1.0 / radius, 0.0);
+        highp vec4 p1 = vec4(pw, ph, PI / radius, (zoom - 1.0) * zoom);
+        highp vec4 p2 = vec4(0, 0, -PI / 2.0, 0.0);
 
-        vec3 tc = vec3(1.0, 0.0, 0.0);
-        vec2 uv = vec2(gl_FragCoord.x, gl_FragCoord.y);
+        highp vec4 t0, t1, t2, t3;
+
+        highp vec2 uv = uv_in * wf_resolution;
 
         t1 = p0.xyww - vec4(uv, 0.0, 0.0);
         t2.x = t2.y = t2.z = t2.w = 1.0 / sqrt(dot(t1.xyz, t1.xyz));
@@ -90,9 +73,7 @@ void main()
 
         t1 = t1 * p1 + p2;
 
-        tc = texture2D(u_texture, t1.xy).rgb;
-
-        gl_FragColor = vec4(tc, 1.0);
+        return t1.xy;
 }
 )";
 
@@ -106,7 +87,7 @@ class wayfire_fisheye : public wf::plugin_interface_t
     wf::option_wrapper_t<double> radius{"fisheye/radius"};
     wf::option_wrapper_t<double> zoom{"fisheye/zoom"};
 
-    OpenGL::program_t program;
+    wf::post_effect_t effect;
 
   public:
     void init() override
@@ -128,10 +109,13 @@ class wayfire_fisheye : public wf::plugin_interface_t
             }
         });
 
-        OpenGL::render_begin();
-        program.set_simple(
-            OpenGL::compile_program(vertex_shader, fragment_shader));
-        OpenGL::render_end();
+        effect.stage  = wf::POST_EFFECT_UV_WARP;
+        effect.source = fisheye_source;
+        effect.set_uniforms = [=] (OpenGL::program_t& program,
+                                   const std::string& name)
+        {
+            set_uniforms(program, name);
+        };
     }
 
     wf::activator_callback toggle_cb = [=] (wf::activator_source_t, uint32_t)
@@ -152,7 +136,7 @@ class wayfire_fisheye : public wf::plugin_interface_t
             if (!hook_set)
             {
                 hook_set = true;
-                output->render->add_post(&render_hook);
+                output->render->add_post_effect(&effect);
                 output->render->set_redraw_always();
             }
         }
@@ -160,50 +144,28 @@ class wayfire_fisheye : public wf::plugin_interface_t
         return true;
     };
 
-    wf::post_hook_t render_hook = [=] (const wf::framebuffer_base_t& source,
-                                       const wf::framebuffer_base_t& dest)
+    void set_uniforms(OpenGL::program_t& program, const std::string& name)
     {
         auto oc     = output->get_cursor_position();
         wlr_box box = {(int)oc.x, (int)oc.y, 1, 1};
         box = output->render->get_target_framebuffer().
             framebuffer_box_from_geometry_box(box);
-        oc.x = box.x;
-        oc.y = box.y;
-
-        static const float vertexData[] = {
-            -1.0f, -1.0f,
-            1.0f, -1.0f,
-            1.0f, 1.0f,
-            -1.0f, 1.0f
-        };
-
-        OpenGL::render_begin(dest);
-        program.use(wf::TEXTURE_TYPE_RGBA);
-        GL_CALL(glBindTexture(GL_TEXTURE_2D, source.tex));
-        GL_CALL(glActiveTexture(GL_TEXTURE0));
-
-        program.uniform2f("u_mouse", oc.x, oc.y);
-        program.uniform2f("u_resolution", dest.viewport_width, dest.viewport_height);
-        program.uniform1f("u_radius", radius);
-        program.uniform1f("u_zoom", progression);
 
-        program.attrib_pointer("position", 2, 0, vertexData);
-
-        GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
-        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-
-        program.deactivate();
-        OpenGL::render_end();
+        program.uniform2f(name + "_mouse", box.x, box.y);
+        program.uniform1f(name + "_radius", radius);
+        program.uniform1f(name + "_zoom", progression);
 
+        /* The effect is still applied in this frame, but the zoom is 0 by now,
+         * so it doesn't change anything */
         if (!active && !progression.running())
         {
             finalize();
         }
-    };
+    }
 
     void finalize()
     {
-        output->render->rem_post(&render_hook);
+        output->render->rem_post_effect(&effect);
         output->render->set_redraw_always(false);
         hook_set = false;
     }
@@ -215,10 +177,6 @@ class wayfire_fisheye : public wf::plugin_interface_t
             finalize();
         }
 
-        OpenGL::render_begin();
-        program.free_resources();
-        OpenGL::render_end();
-
         output->rem_binding(&toggle_cb);
     }
 };
@@ -4,6 +4,17 @@
 #include <wayfire/render-manager.hpp>
 #include <wayfire/util/duration.hpp>
 
+static const char *zoom_source =
+    R"(
+uniform highp float @name@_scale;
+uniform highp vec2 @name@_offset;
+
+highp vec2 @name@(highp vec2 uv)
+{
+    return uv * @name@_scale + @name@_offset;
+}
+)";
+
 class wayfire_zoom_screen : public wf::plugin_interface_t
 {
     wf::option_wrapper_t<wf::keybinding_t> modifier{"zoom/modifier"};
@@ -11,6 +22,7 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
     wf::option_wrapper_t<int> smoothing_duration{"zoom/smoothing_duration"};
     wf::animation::simple_animation_t progression{smoothing_duration};
     bool hook_set = false;
+    wf::post_effect_t effect;
 
   public:
     void init() override
@@ -20,6 +32,14 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
 
         progression.set(1, 1);
 
+        effect.stage  = wf::POST_EFFECT_UV_WARP;
+        effect.source = zoom_source;
+        effect.set_uniforms = [=] (OpenGL::program_t& program,
+                                   const std::string& name)
+        {
+            set_uniforms(program, name);
+        };
+
         output->add_axis(modifier, &axis);
     }
 
@@ -36,7 +56,7 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
             if (!hook_set)
             {
                 hook_set = true;
-                output->render->add_post(&render_hook);
+                output->render->add_post_effect(&effect);
                 output->render->set_redraw_always();
             }
         }
@@ -59,11 +79,11 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
         return true;
     };
 
-    wf::post_hook_t render_hook = [=] (const wf::framebuffer_base_t& source,
-                                       const wf::framebuffer_base_t& destination)
+    void set_uniforms(OpenGL::program_t& program, const std::string& name)
     {
-        auto w = destination.viewport_width;
-        auto h = destination.viewport_height;
+        auto fb = output->render->get_target_framebuffer();
+        auto w  = fb.viewport_width;
+        auto h  = fb.viewport_height;
         auto oc = output->get_cursor_position();
         double x, y;
         wlr_box b = output->get_relative_geometry();
@@ -71,35 +91,30 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
 
         /* get rotation & scale */
         wlr_box box = {int(x), int(y), 1, 1};
-        box = output->render->get_target_framebuffer().
-            framebuffer_box_from_geometry_box(box);
+        box = fb.framebuffer_box_from_geometry_box(box);
 
         x = box.x;
         y = h - box.y;
 
+        /* Show the part of the output which starts at (x1, y1) and is
+         * 1 / progression of its size */
         const float scale = (progression - 1) / progression;
-
-        const float tw = w / progression, th = h / progression;
         const float x1 = x * scale;
         const float y1 = y * scale;
 
-        OpenGL::render_begin(source);
-        GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, source.fb));
-        GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination.fb));
-        GL_CALL(glBlitFramebuffer(x1, y1, x1 + tw, y1 + th, 0, 0, w, h,
-            GL_COLOR_BUFFER_BIT, GL_LINEAR));
-        OpenGL::render_end();
+        program.uniform1f(name + "_scale", 1.0 / progression);
+        program.uniform2f(name + "_offset", x1 / w, y1 / h);
 
         if (!progression.running() && (progression - 1 <= 0.01))
         {
             unset_hook();
         }
-    };
+    }
 
     void unset_hook()
     {
         output->render->set_redraw_always(false);
-        output->render->rem_post(&render_hook);
+        output->render->rem_post_effect(&effect);
         hook_set = false;
     }
 
@@ -107,7 +122,7 @@ class wayfire_zoom_screen : public wf::plugin_interface_t
     {
         if (hook_set)
         {
-            output->render->rem_post(&render_hook);
+            output->render->rem_post_effect(&effect);
         }
 
         output->rem_binding(&axis);
@@ -0,0 +1,36 @@
+#ifndef WF_BENCH_COUNTERS_HPP
+#define WF_BENCH_COUNTERS_HPP
+
+#include <cstdint>
+
+namespace wf
+{
+namespace bench
+{
+/**
+ * Counters maintained by the wayfire-bench harness.
+ * Both counters only grow, callers compute the difference between two samples.
+ */
+struct counters_t
+{
+    /* The number of calls to operator new, from any thread */
+    uint64_t allocations = 0;
+    /* The number of wf::region_t set operations, from any thread */
+    uint64_t region_ops  = 0;
+};
+
+/**
+ * Get the current value of the counters.
+ *
+ * The functions in this file are defined only in the wayfire-bench executable.
+ * They are declared weak, so plugins can check whether they are available
+ * (the address is NULL otherwise) and still load in a regular wayfire.
+ */
+__attribute__((weak)) counters_t get_counters();
+
+/** Count a single region operation. */
+__attribute__((weak)) void count_region_op();
+}
+}
+
+#endif /* end of include guard: WF_BENCH_COUNTERS_HPP */
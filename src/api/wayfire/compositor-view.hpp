@@ -115,6 +115,8 @@ class color_rect_view_t : public wf::view_interface_t, wf::compositor_surface_t
     virtual wf::dimensions_t get_size() const override;
     virtual void simple_render(const wf::framebuffer_t& fb, int x, int y,
         const wf::region_t& damage) override;
+    /** The parts of the rect whose color has alpha 1 are opaque */
+    virtual wf::region_t get_opaque_region(wf::point_t origin) override;
 
     /* required for view_interface_t */
     virtual void move(int x, int y) override;
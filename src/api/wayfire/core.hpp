@@ -56,6 +56,7 @@ namespace wf
 class output_t;
 class output_layout_t;
 class input_device_t;
+class thread_pool_t;
 
 class compositor_core_t : public wf::object_base_t
 {
@@ -81,6 +82,12 @@ class compositor_core_t : public wf::object_base_t
 
     std::unique_ptr<wf::output_layout_t> output_layout;
 
+    /**
+     * A pool of worker threads which plugins can use to split CPU-heavy work,
+     * see wayfire/thread-pool.hpp
+     */
+    std::unique_ptr<wf::thread_pool_t> thread_pool;
+
     /**
      * Various protocols supported by wlroots
      */
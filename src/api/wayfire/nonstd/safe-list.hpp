@@ -2,9 +2,11 @@
 #define WF_SAFE_LIST_HPP
 
 #include <list>
-#include <memory>
+#include <optional>
 #include <algorithm>
 #include <functional>
+#include <stdexcept>
+#include <cstdint>
 
 #include <wayland-server.h>
 
@@ -14,13 +16,19 @@
  *
  * It supports safe iteration over all elements in the collection, where any
  * element can be deleted from the list at any given time (i.e even in a
- * for-each-like loop) */
+ * for-each-like loop).
+ *
+ * Elements erased during an iteration leave an empty node (a tombstone) behind,
+ * which is skipped by the iteration and removed once the outermost iteration
+ * is done. Elements added during an iteration are not visited by it.
+ *
+ * The elements are never moved in memory, so references to an element stay
+ * valid until it is erased, even if other elements are added or erased. */
 namespace wf
 {
-/* The object type depends on the safe list type, and the safe list type
- * needs access to the event loop. However, the event loop is typically
- * available from core.hpp. Because we can't resolve this circular dependency,
- * we provide a link to the event loop specially for the safe list */
+/* The safe list used to remove erased elements from an idle source on this
+ * event loop. It does not need the event loop anymore, but the symbols are
+ * kept so that plugins built against older versions still load. */
 namespace _safe_list_detail
 {
 /* In main.cpp, and initialized there */
@@ -31,38 +39,70 @@ void idle_cleanup_func(void *data);
 template<class T>
 class safe_list_t
 {
-    std::list<std::unique_ptr<T>> list;
-    wl_event_source *idle_cleanup_source = NULL;
+    struct node_t
+    {
+        std::optional<T> value;
+        /* The value of epoch when the element was added */
+        uint64_t epoch;
+    };
 
-    /* Remove all invalidated elements in the list */
-    std::function<void()> do_cleanup = [&] ()
+    /* Iterating is logically const, but it removes the tombstones left by the
+     * elements erased during the iteration when it is done */
+    mutable std::list<node_t> list;
+    /* The number of tombstones in the list */
+    mutable size_t erased = 0;
+    /* The number of running iterations */
+    mutable int iterating = 0;
+    /* Incremented when an iteration starts. An iteration visits only the
+     * elements added before it started, i.e with a smaller epoch. */
+    mutable uint64_t epoch = 0;
+
+    /* Remove all tombstones, if the list is not being iterated */
+    void compact() const
     {
-        auto it = list.begin();
-        while (it != list.end())
+        if (iterating || !erased)
         {
-            if (*it)
-            {
-                ++it;
-            } else
-            {
-                it = list.erase(it);
-            }
+            return;
         }
 
-        idle_cleanup_source = NULL;
+        list.remove_if([] (const node_t& node) { return !node.value; });
+        erased = 0;
+    }
+
+    /* Keeps track of a running iteration, even if the callback throws */
+    struct iteration_guard_t
+    {
+        const safe_list_t& list;
+        const uint64_t start;
+        iteration_guard_t(const safe_list_t& list) :
+            list(list), start(++list.epoch)
+        {
+            ++list.iterating;
+        }
+
+        ~iteration_guard_t()
+        {
+            --list.iterating;
+            list.compact();
+        }
+
+        /* Whether the iteration should visit the given node */
+        bool visits(const node_t& node) const
+        {
+            return node.value && (node.epoch < start);
+        }
     };
 
-    /* Return whether the list has invalidated elements */
-    bool is_dirty() const
+    node_t make_node(T&& value) const
     {
-        return idle_cleanup_source;
+        return node_t{std::optional<T>{std::move(value)}, epoch};
     }
 
   public:
     safe_list_t()
     {}
 
-    /* Copy the not-erased elements from other, but do not copy the idle source */
+    /* Copy the not-erased elements from other */
     safe_list_t(const safe_list_t& other)
     {
         *this = other;
@@ -70,34 +110,23 @@ class safe_list_t
 
     safe_list_t& operator =(const safe_list_t& other)
     {
-        this->idle_cleanup_source = NULL;
+        list.clear();
+        erased = 0;
         other.for_each([&] (auto& el)
         {
             this->push_back(el);
         });
+
+        return *this;
     }
 
     safe_list_t(safe_list_t&& other) = default;
     safe_list_t& operator =(safe_list_t&& other) = default;
 
-    ~safe_list_t()
-    {
-        if (idle_cleanup_source)
-        {
-            wl_event_source_remove(idle_cleanup_source);
-        }
-    }
-
     T& back()
     {
-        /* No invalidated elements */
-        if (!is_dirty())
-        {
-            return *list.back();
-        }
-
         auto it = list.rbegin();
-        while (it != list.rend() && (*it) == nullptr)
+        while (it != list.rend() && !it->value)
         {
             ++it;
         }
@@ -107,36 +136,24 @@ class safe_list_t
             throw std::out_of_range("back() called on an empty list!");
         }
 
-        return **it;
+        return *it->value;
     }
 
     size_t size() const
     {
-        if (!is_dirty())
-        {
-            return list.size();
-        }
-
-        /* Count non-null elements, because that's the real size */
-        size_t sz = 0;
-        for (auto& it : list)
-        {
-            sz += (it != nullptr);
-        }
-
-        return sz;
+        return list.size() - erased;
     }
 
     /* Push back by copying */
     void push_back(T value)
     {
-        list.push_back(std::make_unique<T>(std::move(value)));
+        list.push_back(make_node(std::move(value)));
     }
 
     /* Push back by moving */
     void emplace_back(T&& value)
     {
-        list.push_back(std::make_unique<T>(value));
+        list.push_back(make_node(std::move(value)));
     }
 
     enum insert_place_t
@@ -151,17 +168,15 @@ class safe_list_t
      * check indicates, or at the end of the list otherwise */
     void emplace_at(T&& value, std::function<insert_place_t(T&)> check)
     {
-        auto it = list.begin();
-        while (it != list.end())
+        for (auto it = list.begin(); it != list.end(); ++it)
         {
             /* Skip empty elements */
-            if (*it == nullptr)
+            if (!it->value)
             {
-                ++it;
                 continue;
             }
 
-            auto place = check(**it);
+            auto place = check(*it->value);
             switch (place)
             {
               case INSERT_AFTER:
@@ -171,15 +186,13 @@ class safe_list_t
 
               // fall through
               case INSERT_BEFORE:
-                list.emplace(it, std::make_unique<T>(value));
+                list.insert(it, make_node(std::move(value)));
 
                 return;
 
               default:
                 break;
             }
-
-            ++it;
         }
 
         /* If no place found, insert at the end */
@@ -192,28 +205,32 @@ class safe_list_t
     }
 
     /* Call func for each non-erased element of the list */
-    void for_each(std::function<void(T&)> func) const
+    template<class Func>
+    void for_each(Func&& func) const
     {
-        /* Go through all elements currently in the list */
-        auto it = list.begin();
-        for (int size = list.size(); size > 0; size--, it++)
+        iteration_guard_t guard{*this};
+
+        /* Nodes are not removed while iterating, and adding nodes does not
+         * invalidate the iterators, so func may modify the list freely */
+        for (auto it = list.begin(); it != list.end(); ++it)
         {
-            if (*it)
+            if (guard.visits(*it))
             {
-                func(**it);
+                func(*it->value);
             }
         }
     }
 
     /* Call func for each non-erased element of the list in reversed order */
-    void for_each_reverse(std::function<void(T&)> func) const
+    template<class Func>
+    void for_each_reverse(Func&& func) const
     {
-        auto it = list.rbegin();
-        for (int size = list.size(); size > 0; size--, it++)
+        iteration_guard_t guard{*this};
+        for (auto it = list.rbegin(); it != list.rend(); ++it)
         {
-            if (*it)
+            if (guard.visits(*it))
             {
-                func(**it);
+                func(*it->value);
             }
         }
     }
@@ -231,29 +248,24 @@ class safe_list_t
     }
 
     /* Remove all elements satisfying a given condition.
-     * This function resets their pointers and scheduling a cleanup operation */
-    void remove_if(std::function<bool(const T&)> predicate)
+     * Their nodes are emptied, and removed from the list as soon as it is not
+     * being iterated anymore. */
+    template<class Predicate>
+    void remove_if(Predicate&& predicate)
     {
-        bool actually_removed = false;
-        for (auto& it : list)
+        /* The predicate may modify the list too */
+        iteration_guard_t guard{*this};
+        for (auto& node : list)
         {
-            if (it && predicate(*it))
+            if (node.value && predicate(*node.value))
             {
-                actually_removed = true;
                 /* First reset the element in the list, and then free resources */
-                auto copy = std::move(it);
-                it = nullptr;
+                std::optional<T> copy;
+                copy.swap(node.value);
+                ++erased;
                 /* Now copy goes out of scope */
             }
         }
-
-        /* Schedule a clean-up, but be careful to not schedule it twice */
-        if (!idle_cleanup_source && actually_removed)
-        {
-            idle_cleanup_source = wl_event_loop_add_idle(
-                _safe_list_detail::event_loop,
-                _safe_list_detail::idle_cleanup_func, &do_cleanup);
-        }
     }
 };
 }
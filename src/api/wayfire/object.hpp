@@ -22,6 +22,18 @@ struct signal_data_t
 using signal_callback_t = std::function<void (signal_data_t*)>;
 class signal_provider_t;
 
+/**
+ * An interned signal name. Connecting to and emitting signals by ID avoids
+ * hashing and comparing the signal name every time.
+ */
+using signal_id_t = uint32_t;
+
+/**
+ * Get the ID of the signal with the given name. The ID of a name never changes,
+ * so it can be looked up once and stored, for ex. in a static variable.
+ */
+signal_id_t get_signal_id(const std::string& name);
+
 /**
  * Provides an interface to connect to signal providers.
  *
@@ -67,7 +79,9 @@ class signal_provider_t
 {
   public:
     /** Register a connection to be called when the given signal is emitted. */
-    void connect_signal(std::string name, signal_connection_t *callback);
+    void connect_signal(const std::string& name, signal_connection_t *callback);
+    /** Same as connect_signal(name, callback), with an interned signal name. */
+    void connect_signal(signal_id_t signal, signal_connection_t *callback);
     /** Unregister a connection. */
     void disconnect_signal(signal_connection_t *callback);
 
@@ -75,15 +89,20 @@ class signal_provider_t
      * Deprecated.
      * Register a callback to be called whenever the given signal is emitted
      */
-    void connect_signal(std::string name, signal_callback_t *callback);
+    void connect_signal(const std::string& name, signal_callback_t *callback);
     /**
      * Deprecated.
      * Unregister a registered callback.
      */
-    void disconnect_signal(std::string name, signal_callback_t *callback);
+    void disconnect_signal(const std::string& name, signal_callback_t *callback);
 
     /** Emit the given signal. No type checking for data is required */
-    void emit_signal(std::string name, signal_data_t *data);
+    void emit_signal(const std::string& name, signal_data_t *data);
+    /**
+     * Same as emit_signal(name, data), with an interned signal name.
+     * Emitting a signal nobody has connected to does not allocate anything.
+     */
+    void emit_signal(signal_id_t signal, signal_data_t *data);
 
     virtual ~signal_provider_t();
 
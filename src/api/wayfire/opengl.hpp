@@ -265,6 +265,43 @@ GLuint compile_program(std::string vertex_source, std::string frag_source);
  */
 void render_rectangle(wf::geometry_t box, wf::color_t color, glm::mat4 matrix);
 
+/** Statistics of the pool of intermediate framebuffers */
+struct framebuffer_pool_stats_t
+{
+    /* The number of borrowed framebuffers which were taken from the pool */
+    uint64_t hits;
+    /* The number of borrowed framebuffers which had to be allocated */
+    uint64_t misses;
+    /* The number of framebuffers currently borrowed */
+    int borrowed;
+    /* The number of framebuffers waiting in the pool to be reused */
+    int pooled;
+    /* The approximate size of all borrowed and pooled framebuffers in bytes */
+    size_t bytes;
+};
+
+/**
+ * Borrow a framebuffer of exactly the given size from the pool of intermediate
+ * framebuffers, for ex. to store the result of a transformer. Framebuffers are
+ * pooled by their size, so views of the same size share their buffers. The
+ * contents of the framebuffer are undefined.
+ *
+ * Pooled framebuffers which have not been borrowed for a second are released.
+ *
+ * @param fb The framebuffer to store the borrowed buffer in. It must not have
+ *   any buffer allocated. Only the fields of wf::framebuffer_base_t are set.
+ */
+void borrow_framebuffer(wf::framebuffer_base_t& fb, int width, int height);
+
+/**
+ * Return a framebuffer borrowed with borrow_framebuffer() to the pool.
+ * Afterwards, fb does not hold any buffer anymore.
+ */
+void return_framebuffer(wf::framebuffer_base_t& fb);
+
+/** @return Statistics of the pool of intermediate framebuffers */
+framebuffer_pool_stats_t get_framebuffer_pool_stats();
+
 /**
  * An OpenGL program for rendering texture_t.
  * It contains multiple programs for the different texture types.
@@ -361,6 +398,65 @@ class program_t : public noncopyable_t
     class impl;
     std::unique_ptr<impl> priv;
 };
+
+/**
+ * Collects textured and colored quads, each clipped to a scissor box, and draws
+ * them with as few draw calls as possible.
+ *
+ * Instead of setting the scissor for each quad, the quads are clipped to their
+ * scissor box (rounded to whole framebuffer pixels, like logic_scissor()) and
+ * their vertices are written to a shared vertex buffer. Consecutive quads with
+ * the same texture, program and color are then drawn with a single call, so
+ * that a surface with hundreds of damaged rectangles is drawn at once. Quads
+ * are never reordered, so overlapping quads are blended in the order they
+ * were added.
+ *
+ * All quads are rendered with the orthographic projection of the framebuffer.
+ */
+class quad_batch_t : public noncopyable_t
+{
+  public:
+    quad_batch_t();
+    ~quad_batch_t();
+
+    /**
+     * Start collecting quads for the given framebuffer. Quads which have not
+     * been flushed yet are discarded.
+     */
+    void begin(const wf::framebuffer_t& fb);
+
+    /**
+     * Add a textured quad, see render_transformed_texture().
+     *
+     * @param scissor The box to clip the quad to, in the same coordinate
+     *   system as the framebuffer geometry.
+     */
+    void add_texture(wf::texture_t texture, const gl_geometry& g,
+        const gl_geometry& texg, wlr_box scissor,
+        glm::vec4 color = glm::vec4(1.f), uint32_t bits = 0);
+
+    /** Add a textured quad, see render_texture() */
+    void add_texture(wf::texture_t texture, const wf::geometry_t& geometry,
+        wlr_box scissor, glm::vec4 color = glm::vec4(1.f), uint32_t bits = 0);
+
+    /**
+     * Add a quad with a single color, see render_rectangle(). The color should
+     * be premultiplied.
+     */
+    void add_rectangle(const wf::geometry_t& geometry, wf::color_t color,
+        wlr_box scissor);
+
+    /**
+     * Draw all quads collected since the last flush. Must be called between
+     * render_begin() and render_end() with the framebuffer bound. Disables
+     * the scissor test.
+     */
+    void flush();
+
+  private:
+    class impl;
+    std::unique_ptr<impl> priv;
+};
 }
 
 /* utils */
@@ -3,6 +3,15 @@
 
 #include "wayfire/output.hpp"
 #include "wayfire/object.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+#include <time.h>
+
+namespace OpenGL
+{
+class program_t;
+}
 
 namespace wf
 {
@@ -50,6 +59,182 @@ enum output_effect_type_t
 using post_hook_t = std::function<void (const wf::framebuffer_base_t& source,
     const wf::framebuffer_base_t& destination)>;
 
+/** The kinds of fused post effects */
+enum post_effect_stage_t
+{
+    /* The effect changes which pixel of the output image is shown where */
+    POST_EFFECT_UV_WARP = 0,
+    /* The effect changes the color of each pixel independently */
+    POST_EFFECT_COLOR   = 1,
+};
+
+/**
+ * A post effect which is described by a snippet of GLSL instead of a whole
+ * pass. All fused post effects on an output are combined into a single
+ * generated fragment program, so they cost one pass over the output image
+ * together. The generated programs are cached per combination of effects.
+ *
+ * The snippet must define a function whose name is the special symbol
+ * `@name@`, which is replaced with a unique identifier:
+ *
+ *   POST_EFFECT_UV_WARP: `highp vec2 @name@(highp vec2 uv)` gets the texture
+ *     coordinates of a pixel in the result, and returns the coordinates from
+ *     which the pixel should be taken.
+ *   POST_EFFECT_COLOR: `mediump vec4 @name@(mediump vec4 color)` returns the
+ *     new color of a pixel.
+ *
+ * Other identifiers defined by the snippet, including uniforms, should start
+ * with `@name@` as well. The snippet may use the uniform
+ * `highp vec2 wf_resolution`, the size of the output image in pixels.
+ *
+ * Fused effects are applied in the order they were added, before all
+ * post_hook_t. If the generated program cannot be compiled, each effect is
+ * run as a separate pass, and an effect which cannot be compiled alone is
+ * skipped.
+ */
+struct post_effect_t
+{
+    post_effect_stage_t stage;
+    std::string source;
+
+    /**
+     * Called before each frame to set the uniforms of the snippet.
+     *
+     * @param program The program, already in use.
+     * @param name The identifier which replaced `@name@` in the source.
+     */
+    std::function<void (OpenGL::program_t& program,
+        const std::string& name)> set_uniforms;
+};
+
+/** The phases of a frame whose duration is recorded by the render manager */
+enum frame_phase_t
+{
+    /* Running the OUTPUT_EFFECT_PRE hooks */
+    FRAME_PHASE_PRE          = 0,
+    /* Running the render hook, or the default renderer */
+    FRAME_PHASE_RENDER       = 1,
+    /* Running the OUTPUT_EFFECT_OVERLAY hooks */
+    FRAME_PHASE_OVERLAY      = 2,
+    /* Rendering software cursors */
+    FRAME_PHASE_SW_CURSORS   = 3,
+    /* Running the post hooks */
+    FRAME_PHASE_POST_EFFECTS = 4,
+    /* Swapping buffers */
+    FRAME_PHASE_SWAP         = 5,
+    /* Running the OUTPUT_EFFECT_POST hooks and sending frame callbacks */
+    FRAME_PHASE_POST         = 6,
+    /* Invalid phase, used internally */
+    FRAME_PHASE_TOTAL        = 7,
+};
+
+/** How the contents of a frame were produced */
+enum frame_path_t
+{
+    /* The current workspace was composited, or a render hook was used */
+    FRAME_PATH_COMPOSITED = 0,
+    /* Only the surfaces of an opaque fullscreen view were rendered */
+    FRAME_PATH_FULLSCREEN = 1,
+    /* The buffer of a fullscreen view was presented directly, without
+     * rendering anything */
+    FRAME_PATH_SCANOUT    = 2,
+    /* Invalid path, used internally */
+    FRAME_PATH_TOTAL      = 3,
+};
+
+/** The time spent in a single effect or post hook during a frame */
+struct hook_timing_t
+{
+    /* A human-readable name of the hook, derived from its type. For lambdas,
+     * this includes the class or function where they were defined. */
+    std::string name;
+    /* The phase during which the hook was run */
+    frame_phase_t phase;
+    /* The duration in microseconds */
+    int64_t duration;
+};
+
+/**
+ * The timings of a single frame on an output.
+ *
+ * The durations are measured on the CPU, in microseconds. GPU work is
+ * accounted to the phase in which the driver waits for it, usually
+ * FRAME_PHASE_SWAP.
+ */
+struct frame_timing_t
+{
+    /* The time the frame was started, in the presentation clock */
+    timespec start;
+    /* The duration of the whole frame */
+    int64_t total;
+    /* The duration of each phase */
+    int64_t phases[FRAME_PHASE_TOTAL];
+    /* How the frame was produced */
+    frame_path_t path;
+    /* The duration of each hook that was run, in the order they were run */
+    std::vector<hook_timing_t> hooks;
+};
+
+/**
+ * name: frame-timing
+ * on: render-manager
+ * when: After each repainted frame, if frame timing is enabled via
+ *   core/frame_timing_history.
+ */
+struct frame_timing_signal : public signal_data_t
+{
+    wf::output_t *output;
+    const frame_timing_t *timing;
+};
+
+/** The memory used by the buffers of the workspace streams on an output */
+struct stream_memory_usage_t
+{
+    /* The number of allocated buffers, including idle ones */
+    int buffers;
+    /* The number of buffers kept for reuse after their stream was stopped */
+    int idle_buffers;
+    /* The approximate size of all buffers in bytes */
+    size_t bytes;
+    /* The configured budget in bytes, 0 if there is no budget */
+    size_t budget;
+};
+
+/**
+ * The render delay of an output, i.e the time between a frame event and the
+ * start of the repaint.
+ */
+struct render_delay_stats_t
+{
+    /* The delay chosen for the last frame, in milliseconds */
+    int64_t delay;
+    /* The time reserved for the repaint, in milliseconds. With
+     * core/adaptive_render_delay, it is derived from the recent repaints. */
+    int render_time;
+    /* The fraction of the recently repainted frames which missed a vblank */
+    double miss_rate;
+    /* The number of repainted frames which missed a vblank */
+    uint64_t missed_frames;
+};
+
+/**
+ * The damage repainted on an output since it was created, before and after
+ * merging rectangles, see core/damage_rect_limit.
+ */
+struct damage_stats_t
+{
+    /* The number of repainted damage regions */
+    uint64_t regions;
+    /* The number of regions whose rectangles were merged */
+    uint64_t simplified;
+    /* The total number of rectangles before and after merging */
+    uint64_t rects_before;
+    uint64_t rects_after;
+    /* The total number of pixels before and after merging */
+    uint64_t pixels_before;
+    uint64_t pixels_after;
+};
+
 /** Render manager
  *
  * Each output has a render manager, which is responsible for all rendering
@@ -120,6 +305,20 @@ class render_manager : public wf::signal_provider_t
      */
     void rem_post(post_hook_t *hook);
 
+    /**
+     * Add a fused post effect.
+     *
+     * @param effect The effect, which must stay alive until it is removed.
+     */
+    void add_post_effect(post_effect_t *effect);
+
+    /**
+     * Remove a fused post effect. No-op if the effect isn't active.
+     *
+     * @param effect The effect to be removed.
+     */
+    void rem_post_effect(post_effect_t *effect);
+
     /**
      * @return The damaged region on the current output for the current
      * frame that is used when swapping buffers. This function should
@@ -177,7 +376,8 @@ class render_manager : public wf::signal_provider_t
 
     /**
      * Initialize a workspace stream. If you need to change the stream's
-     * attributes, you should stop the stream, and start it again
+     * attributes, you should stop the stream, and start it again. The stream
+     * is started with its current scale_x and scale_y.
      *
      * @param stream The stream to be initialized
      */
@@ -188,9 +388,13 @@ class render_manager : public wf::signal_provider_t
      * This function should be called inside the rendering cycle, i.e in a
      * render or an overlay hook.
      *
+     * The stream is rendered at a reduced resolution if the scale is less than
+     * 1, and then it has mipmaps. The scale is uniform, the larger of scale_x
+     * and scale_y is used. Changing the scale repaints the whole stream.
+     *
      * @param stream The workspace stream to update
-     * @param scale_x Unused for now
-     * @param scale_y Unused for now
+     * @param scale_x The horizontal scale of the stream
+     * @param scale_y The vertical scale of the stream
      */
     void workspace_stream_update(workspace_stream_t& stream,
         float scale_x = 1, float scale_y = 1);
@@ -202,6 +406,47 @@ class render_manager : public wf::signal_provider_t
      */
     void workspace_stream_stop(workspace_stream_t& stream);
 
+    /**
+     * @return The timings of the last repainted frames on this output, from
+     * the oldest to the newest. At most core/frame_timing_history frames are
+     * kept, and none if the option is set to 0.
+     */
+    std::vector<frame_timing_t> get_frame_timings() const;
+
+    /**
+     * Write the timings of the last repainted frames on this output as text,
+     * one line for each frame followed by one line for each hook.
+     *
+     * @param out The stream to write to
+     */
+    void dump_frame_timings(std::ostream& out) const;
+
+    /**
+     * @return The number of frames repainted on this output through the given
+     * path since the output was created.
+     */
+    uint64_t get_frame_count(frame_path_t path) const;
+
+    /**
+     * @return The memory currently used by the buffers of the workspace
+     * streams on this output. Buffers of stopped streams are released after
+     * core/stream_idle_timeout, and the least recently used buffers are
+     * released when the usage exceeds core/stream_memory_budget.
+     */
+    stream_memory_usage_t get_stream_memory_usage() const;
+
+    /**
+     * @return The current render delay of this output and how often frames
+     * missed their vblank, see core/adaptive_render_delay.
+     */
+    render_delay_stats_t get_render_delay_stats() const;
+
+    /**
+     * @return How many rectangles and pixels were repainted on this output,
+     * before and after fragmented damage was simplified.
+     */
+    damage_stats_t get_damage_stats() const;
+
   private:
     class impl;
     std::unique_ptr<impl> pimpl;
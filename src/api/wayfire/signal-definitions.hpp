@@ -472,8 +472,12 @@ struct view_geometry_changed_signal : public _view_signal
  * on: view
  * when: Whenever a region of the view becomes damaged, for ex. when the client
  *   updates its contents.
- * argument: Unused.
  */
+struct view_region_damaged_signal : public _view_signal
+{
+    /** The damaged box, in output-local coordinates */
+    wlr_box box;
+};
 
 /**
  * name: decoration-state-updated
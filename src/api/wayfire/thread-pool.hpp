@@ -0,0 +1,63 @@
+#ifndef WF_THREAD_POOL_HPP
+#define WF_THREAD_POOL_HPP
+
+#include <functional>
+#include <memory>
+#include <wayfire/nonstd/noncopyable.hpp>
+
+namespace wf
+{
+/**
+ * A pool of persistent worker threads, used to split CPU-heavy work like
+ * particle simulations between the available cores without creating new
+ * threads each frame.
+ *
+ * Work is split into chunks which are distributed between per-worker queues.
+ * Idle workers steal chunks from the queues of busy ones, and the thread which
+ * submitted the work helps process it while waiting.
+ *
+ * The compositor has a single thread pool, available as
+ * wf::get_core().thread_pool. The tasks must not call into the compositor
+ * (views, outputs, OpenGL, etc.), as it is not thread-safe.
+ */
+class thread_pool_t : public noncopyable_t
+{
+  public:
+    /**
+     * A task which processes the items in the range [begin, end).
+     */
+    using range_task_t = std::function<void (int begin, int end)>;
+
+    /**
+     * Create a new thread pool.
+     *
+     * @param num_workers The number of worker threads. If it is negative, one
+     *   worker less than the number of hardware threads is used, so that
+     *   together with the submitting thread all cores are busy.
+     */
+    thread_pool_t(int num_workers = -1);
+    ~thread_pool_t();
+
+    /** @return The number of worker threads of the pool */
+    int get_num_workers() const;
+
+    /**
+     * Process the range [0, count) in parallel, and wait until all of it has
+     * been processed. The range is split into chunks of at least grain items,
+     * and task is called once for each chunk, possibly from different threads
+     * at the same time. It may be called from a task as well.
+     *
+     * @param count The number of items to process.
+     * @param grain The minimal number of items in a chunk. Ranges with at most
+     *   grain items are processed directly on the calling thread.
+     * @param task The task to run for each chunk.
+     */
+    void parallel_for(int count, int grain, const range_task_t& task);
+
+  private:
+    class impl;
+    std::unique_ptr<impl> pimpl;
+};
+}
+
+#endif /* end of include guard: WF_THREAD_POOL_HPP */
@@ -20,10 +20,10 @@ struct region_t
     ~region_t();
 
     region_t(const region_t& other);
-    region_t(region_t&& other);
+    region_t(region_t&& other) noexcept;
 
     region_t& operator =(const region_t& other);
-    region_t& operator =(region_t&& other);
+    region_t& operator =(region_t&& other) noexcept;
 
     bool empty() const;
     void clear();
@@ -19,6 +19,17 @@ enum transformer_z_order_t
     TRANSFORMER_BLUR      = 999,
 };
 
+enum transformer_capabilities_t
+{
+    /**
+     * The transformer is an affine 2D transform with a color multiplier, which
+     * is described by get_direct_transform(). Views whose transformers all
+     * have this capability are rendered without a snapshot or intermediate
+     * buffers, by drawing each surface directly to the target framebuffer.
+     */
+    TRANSFORMER_CAP_DIRECT = (1 << 0),
+};
+
 class view_transformer_t
 {
   public:
@@ -84,6 +95,45 @@ class view_transformer_t
      */
     virtual wlr_box get_bounding_box(wf::geometry_t view, wlr_box region);
 
+    /**
+     * Get how large the view is shown after this transformer, relative to its
+     * size before it. The snapshot of the view may be rendered at a reduced
+     * resolution according to this hint, see view_interface_t::take_snapshot().
+     *
+     * The default implementation returns 1.0, i.e full resolution.
+     */
+    virtual float get_snapshot_scale()
+    {
+        return 1.0;
+    }
+
+    /**
+     * @return A bitwise OR of transformer_capabilities_t. The default
+     *   implementation returns 0, i.e the view is rendered via its snapshot.
+     */
+    virtual uint32_t get_capabilities()
+    {
+        return 0;
+    }
+
+    /**
+     * Get the transform as a matrix, if the transformer has
+     * TRANSFORMER_CAP_DIRECT. The transformed view must look the same as if
+     * its snapshot was rendered with render_with_damage().
+     *
+     * @param view The bounding box of the view up to this transformer, in
+     *   output-local coordinates.
+     * @param color The color multiplier of the transformer is multiplied
+     *   into this.
+     *
+     * @return The matrix mapping output-local coordinates before the
+     *   transform to output-local coordinates after it.
+     */
+    virtual glm::mat4 get_direct_transform(wf::geometry_t view, glm::vec4& color)
+    {
+        return glm::mat4(1.0);
+    }
+
     /**
      * Render the indicated parts of the view.
      *
@@ -138,6 +188,10 @@ class view_2D : public view_transformer_t
         wf::geometry_t view, wf::pointf_t point) override;
     void render_box(wf::texture_t src_tex, wlr_box src_box,
         wlr_box scissor_box, const wf::framebuffer_t& target_fb) override;
+    float get_snapshot_scale() override;
+    uint32_t get_capabilities() override;
+    glm::mat4 get_direct_transform(wf::geometry_t view,
+        glm::vec4& color) override;
 };
 
 /* Those are centered relative to the view's bounding box */
@@ -415,6 +415,10 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
      * A snapshot of the view is a copy of the view's contents into a
      * framebuffer. It is used to get an image of the view while it is mapped,
      * and continue displaying it afterwards.
+     *
+     * Snapshots of mapped views may be released when they are not used, and
+     * may be rendered at a reduced resolution if the view's transformers show
+     * it smaller, see view_transformer_t::get_snapshot_scale().
      */
     virtual void take_snapshot();
 
@@ -514,6 +518,26 @@ class view_interface_t : public surface_interface_t, public wf::object_base_t
 };
 
 wayfire_view wl_surface_to_wayfire_view(wl_resource *surface);
+
+/** Statistics about the snapshots of all views, see take_snapshot() */
+struct snapshot_cache_stats_t
+{
+    /* The number of allocated snapshots */
+    int snapshots;
+    /* The number of snapshots stored at a reduced resolution */
+    int reduced;
+    /* The approximate size of all snapshots in bytes */
+    size_t bytes;
+    /* The configured budget in bytes, 0 if there is no budget */
+    size_t budget;
+    /* The number of snapshots released because they were no longer used */
+    uint64_t released_idle;
+    /* The number of snapshots released to stay within the budget */
+    uint64_t released_budget;
+};
+
+/** @return Statistics about the snapshots of all views */
+snapshot_cache_stats_t get_snapshot_cache_stats();
 }
 
 #endif
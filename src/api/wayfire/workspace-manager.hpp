@@ -2,6 +2,7 @@
 #define WORKSPACE_MANAGER_HPP
 
 #include <functional>
+#include <memory>
 #include <vector>
 #include <wayfire/view.hpp>
 
@@ -20,6 +21,74 @@ struct workspace_implementation_t
     {}
 };
 
+/**
+ * A read-only list of views, as returned by the *_snapshot() functions of the
+ * workspace manager.
+ *
+ * The workspace manager caches the lists it returns until the views are
+ * restacked (or, for the views on a workspace, moved), so getting a snapshot
+ * does not copy the views. A snapshot never changes after it has been
+ * returned, so views may be restacked while iterating over it.
+ */
+class view_snapshot_t
+{
+  public:
+    using container_t = std::vector<wayfire_view>;
+
+    view_snapshot_t(std::shared_ptr<const container_t> views) :
+        views(std::move(views))
+    {}
+
+    container_t::const_iterator begin() const
+    {
+        return views->begin();
+    }
+
+    container_t::const_iterator end() const
+    {
+        return views->end();
+    }
+
+    container_t::const_reverse_iterator rbegin() const
+    {
+        return views->rbegin();
+    }
+
+    container_t::const_reverse_iterator rend() const
+    {
+        return views->rend();
+    }
+
+    size_t size() const
+    {
+        return views->size();
+    }
+
+    bool empty() const
+    {
+        return views->empty();
+    }
+
+    const wayfire_view& front() const
+    {
+        return views->front();
+    }
+
+    const wayfire_view& operator [](size_t i) const
+    {
+        return (*views)[i];
+    }
+
+    /** @return A copy of the views in the snapshot */
+    container_t to_vector() const
+    {
+        return *views;
+    }
+
+  private:
+    std::shared_ptr<const container_t> views;
+};
+
 /**
  * Wayfire organizes views into several layers, in order to simplify z ordering.
  */
@@ -137,6 +206,13 @@ class workspace_manager
     std::vector<wayfire_view> get_views_on_workspace(wf::point_t ws,
         uint32_t layer_mask);
 
+    /**
+     * Same as get_views_on_workspace(), but returns a cached snapshot of the
+     * views instead of a copy.
+     */
+    view_snapshot_t get_views_on_workspace_snapshot(wf::point_t ws,
+        uint32_t layer_mask);
+
     /**
      * Get a list of all views visible on the given workspace and in the given
      * sublayer.
@@ -220,6 +296,12 @@ class workspace_manager
      */
     std::vector<wayfire_view> get_views_in_layer(uint32_t layers_mask);
 
+    /**
+     * Same as get_views_in_layer(), but returns a cached snapshot of the views
+     * instead of a copy.
+     */
+    view_snapshot_t get_views_in_layer_snapshot(uint32_t layers_mask);
+
     /**
      * Get a list of reordered fullscreen views as explained in
      * get_views_in_layer().
@@ -234,6 +316,12 @@ class workspace_manager
      */
     std::vector<wayfire_view> get_promoted_views(wf::point_t workspace);
 
+    /**
+     * Same as get_promoted_views(workspace), but returns a cached snapshot of
+     * the views instead of a copy.
+     */
+    view_snapshot_t get_promoted_views_snapshot(wf::point_t workspace);
+
     /**
      * @return A list of all views in the given sublayer.
      */
@@ -0,0 +1,79 @@
+#include <wayfire/bench-counters.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/* Built only into the wayfire-bench executable, see src/meson.build.
+ * The executable is linked with -rdynamic, so the replaced operator new is
+ * also used by the plugins it loads. */
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> region_ops{0};
+
+wf::bench::counters_t wf::bench::get_counters()
+{
+    counters_t counters;
+    counters.allocations = allocations.load(std::memory_order_relaxed);
+    counters.region_ops  = region_ops.load(std::memory_order_relaxed);
+
+    return counters;
+}
+
+void wf::bench::count_region_op()
+{
+    region_ops.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void *counted_malloc(std::size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    /* operator new must return a unique pointer even for 0 bytes */
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size)
+{
+    if (void *ptr = counted_malloc(size))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
@@ -21,6 +21,8 @@ struct wf_gtk_shell;
 
 namespace wf
 {
+class snapshot_cache_t;
+
 class compositor_core_impl_t : public compositor_core_t
 {
   public:
@@ -36,6 +38,7 @@ class compositor_core_impl_t : public compositor_core_t
 
     std::unique_ptr<input_manager> input;
     std::unique_ptr<input_method_relay> im_relay;
+    std::unique_ptr<snapshot_cache_t> snapshot_cache;
 
     /**
      * Initialize the compositor core. Called only by main()
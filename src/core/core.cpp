@@ -49,12 +49,14 @@ extern "C"
 #include <wayfire/output-layout.hpp>
 #include <wayfire/workspace-manager.hpp>
 #include <wayfire/signal-definitions.hpp>
+#include <wayfire/thread-pool.hpp>
 
 #include "opengl-priv.hpp"
 #include "seat/input-manager.hpp"
 #include "seat/input-method-relay.hpp"
 #include "seat/touch.hpp"
 #include "../view/view-impl.hpp"
+#include "../view/snapshot-cache.hpp"
 #include "../output/wayfire-shell.hpp"
 #include "../output/output-impl.hpp"
 #include "../output/gtk-shell.hpp"
@@ -199,6 +201,8 @@ void wf::compositor_core_impl_t::init()
      * init_desktop_apis() should come before input.
      * 4. GTK expects primary selection early. */
     compositor = wlr_compositor_create(display, renderer);
+    thread_pool = std::make_unique<wf::thread_pool_t>();
+    snapshot_cache = std::make_unique<wf::snapshot_cache_t>();
 
     protocols.data_device = wlr_data_device_manager_create(display);
     protocols.gtk_primary_selection =
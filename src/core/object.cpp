@@ -1,33 +1,129 @@
 #include "wayfire/object.hpp"
 #include "wayfire/nonstd/safe-list.hpp"
 #include <unordered_map>
-#include <set>
+#include <algorithm>
+#include <vector>
 
 /* Implementation note: because of circular dependencies between
  * signal_connection_t and signal_provider_t, the chosen way to resolve
  * them is to have signal_provider_t directly modify signal_connection_t
  * private data when needed. */
 
+namespace
+{
+/**
+ * The connections to a single signal of a provider, in the order in which
+ * they were connected.
+ *
+ * Each connection knows the slots it occupies (see signal_connection_t::impl),
+ * so disconnecting just empties the slot. Empty slots are skipped during
+ * emission, and removed once they are at least half of the list and the
+ * signal is not being emitted.
+ */
+struct connection_list_t
+{
+    std::vector<wf::signal_connection_t*> slots;
+    size_t num_empty = 0;
+    int emitting     = 0;
+
+    void erase(size_t index)
+    {
+        slots[index] = nullptr;
+        ++num_empty;
+    }
+
+    void compact_if_needed();
+};
+}
+
 class wf::signal_connection_t::impl
 {
   public:
+    signal_connection_t *self;
     signal_callback_t callback;
-    std::set<nonstd::observer_ptr<signal_provider_t>> connected_providers;
 
-    void add(signal_provider_t *provider)
+    /** A slot occupied by the connection in a provider's connection list */
+    struct link_t
+    {
+        signal_provider_t *provider;
+        connection_list_t *list;
+        size_t index;
+    };
+
+    std::vector<link_t> links;
+
+    void add(signal_provider_t *provider, connection_list_t *list)
     {
-        connected_providers.insert(provider);
+        list->slots.push_back(self);
+        links.push_back({provider, list, list->slots.size() - 1});
     }
 
+    /** Empty the slots of the connection in the lists of the given provider */
     void remove(signal_provider_t *provider)
     {
-        connected_providers.erase(provider);
+        auto it = std::stable_partition(links.begin(), links.end(),
+            [=] (const link_t& link) { return link.provider != provider; });
+
+        /* Erase first and compact later, so that compacting one list does not
+         * move the slots which are still to be erased */
+        std::vector<link_t> removed(it, links.end());
+        links.erase(it, links.end());
+        for (auto& link : removed)
+        {
+            link.list->erase(link.index);
+        }
+
+        for (auto& link : removed)
+        {
+            link.list->compact_if_needed();
+        }
+    }
+
+    /** Update the link to a slot which was moved while compacting a list */
+    void moved(connection_list_t *list, size_t from, size_t to)
+    {
+        for (auto& link : links)
+        {
+            if ((link.list == list) && (link.index == from))
+            {
+                link.index = to;
+
+                return;
+            }
+        }
     }
 };
 
+void connection_list_t::compact_if_needed()
+{
+    if (emitting || (num_empty == 0) || (2 * num_empty < slots.size()))
+    {
+        return;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        if (slots[i])
+        {
+            if (i != size)
+            {
+                slots[i]->priv->moved(this, i, size);
+                slots[size] = slots[i];
+            }
+
+            ++size;
+        }
+    }
+
+    slots.resize(size);
+    num_empty = 0;
+}
+
 wf::signal_connection_t::signal_connection_t()
 {
     this->priv = std::make_unique<impl>();
+    this->priv->self = this;
 }
 
 wf::signal_connection_t::~signal_connection_t()
@@ -50,21 +146,80 @@ void wf::signal_connection_t::emit(signal_data_t *data)
 
 void wf::signal_connection_t::disconnect()
 {
-    auto connected = this->priv->connected_providers;
-    for (auto& provider : connected)
+    auto links = std::move(this->priv->links);
+    this->priv->links.clear();
+    for (auto& link : links)
+    {
+        link.list->erase(link.index);
+    }
+
+    for (auto& link : links)
     {
-        provider->disconnect_signal(this);
+        link.list->compact_if_needed();
     }
 }
 
+wf::signal_id_t wf::get_signal_id(const std::string& name)
+{
+    /* Signals are used only from the main thread, so no locking is needed */
+    static std::unordered_map<std::string, signal_id_t> ids;
+
+    auto it = ids.find(name);
+    if (it != ids.end())
+    {
+        return it->second;
+    }
+
+    signal_id_t id = ids.size();
+    ids.emplace(name, id);
+
+    return id;
+}
+
 class wf::signal_provider_t::sprovider_impl
 {
   public:
-    std::unordered_map<std::string,
-        wf::safe_list_t<signal_connection_t*>> signals;
+    /** The connections to a single signal */
+    struct signal_t
+    {
+        signal_id_t id;
+        connection_list_t connections;
+        wf::safe_list_t<signal_callback_t*> deprecated_callbacks;
+    };
+
+    /* A provider has connections to a handful of signals, so a flat list is
+     * faster to search than a map. The entries are never removed, and they are
+     * allocated separately, so that connecting to a new signal while emitting
+     * another does not invalidate the one being emitted. */
+    std::vector<std::unique_ptr<signal_t>> signals;
+
+    /** @return The entry of the given signal, or nullptr if there is none */
+    signal_t *find(signal_id_t id)
+    {
+        for (auto& signal : signals)
+        {
+            if (signal->id == id)
+            {
+                return signal.get();
+            }
+        }
+
+        return nullptr;
+    }
 
-    std::unordered_map<std::string,
-        wf::safe_list_t<signal_callback_t*>> deprecated_signals;
+    /** @return The entry of the given signal, created if it does not exist */
+    signal_t& find_or_create(signal_id_t id)
+    {
+        if (auto signal = find(id))
+        {
+            return *signal;
+        }
+
+        signals.push_back(std::make_unique<signal_t>());
+        signals.back()->id = id;
+
+        return *signals.back();
+    }
 };
 
 wf::signal_provider_t::signal_provider_t()
@@ -76,62 +231,85 @@ wf::signal_provider_t::~signal_provider_t()
 {
     for (auto& s : sprovider_priv->signals)
     {
-        s.second.for_each([=] (signal_connection_t *connection)
+        for (auto& connection : s->connections.slots)
         {
-            connection->priv->remove(this);
-        });
+            if (connection)
+            {
+                auto& links = connection->priv->links;
+                links.erase(std::remove_if(links.begin(), links.end(),
+                    [=] (const auto& link) { return link.provider == this; }),
+                    links.end());
+            }
+        }
     }
 }
 
-void wf::signal_provider_t::connect_signal(std::string name,
+void wf::signal_provider_t::connect_signal(const std::string& name,
     signal_connection_t *callback)
 {
-    sprovider_priv->signals[name].push_back(callback);
-    callback->priv->add(this);
+    connect_signal(get_signal_id(name), callback);
 }
 
-void wf::signal_provider_t::disconnect_signal(signal_connection_t *connection)
+void wf::signal_provider_t::connect_signal(signal_id_t signal,
+    signal_connection_t *callback)
 {
-    for (auto& s : sprovider_priv->signals)
-    {
-        s.second.remove_if([=] (signal_connection_t *connected)
-        {
-            if (connected == connection)
-            {
-                connected->priv->remove(this);
-
-                return true;
-            }
+    callback->priv->add(this, &sprovider_priv->find_or_create(signal).connections);
+}
 
-            return false;
-        });
-    }
+void wf::signal_provider_t::disconnect_signal(signal_connection_t *connection)
+{
+    connection->priv->remove(this);
 }
 
 /* Deprecated: */
-void wf::signal_provider_t::connect_signal(std::string name,
+void wf::signal_provider_t::connect_signal(const std::string& name,
     signal_callback_t *callback)
 {
-    sprovider_priv->deprecated_signals[name].push_back(callback);
+    sprovider_priv->find_or_create(get_signal_id(name)).deprecated_callbacks
+        .push_back(callback);
 }
 
 /* Deprecated: */
-void wf::signal_provider_t::disconnect_signal(std::string name,
+void wf::signal_provider_t::disconnect_signal(const std::string& name,
     signal_callback_t *callback)
 {
-    sprovider_priv->deprecated_signals[name].remove_all(callback);
+    if (auto signal = sprovider_priv->find(get_signal_id(name)))
+    {
+        signal->deprecated_callbacks.remove_all(callback);
+    }
+}
+
+void wf::signal_provider_t::emit_signal(const std::string& name,
+    wf::signal_data_t *data)
+{
+    emit_signal(get_signal_id(name), data);
 }
 
 /* Emit the given signal. No type checking for data is required */
-void wf::signal_provider_t::emit_signal(std::string name, wf::signal_data_t *data)
+void wf::signal_provider_t::emit_signal(signal_id_t id, wf::signal_data_t *data)
 {
-    sprovider_priv->signals[name].for_each([data] (auto call)
+    auto signal = sprovider_priv->find(id);
+    if (!signal)
     {
-        call->emit(data);
-    });
+        return;
+    }
+
+    /* Connections added during the emission are not called */
+    auto& connections = signal->connections;
+    ++connections.emitting;
+    for (size_t i = 0, n = connections.slots.size(); i < n; i++)
+    {
+        if (auto connection = connections.slots[i])
+        {
+            connection->emit(data);
+        }
+    }
+
+    --connections.emitting;
+    connections.compact_if_needed();
 
     /* Deprecated: */
-    sprovider_priv->deprecated_signals[name].for_each([data] (auto call)
+    signal->deprecated_callbacks.for_each([data] (auto call)
     {
         (*call)(data);
     });
@@ -1,5 +1,8 @@
 #include <wayfire/util/log.hpp>
+#include <algorithm>
+#include <cstddef>
 #include <map>
+#include <vector>
 #include "opengl-priv.hpp"
 #include "wayfire/output.hpp"
 #include "core-impl.hpp"
@@ -16,6 +19,7 @@ extern "C"
 }
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/vec2.hpp>
 
 #include "shaders.tpp"
 
@@ -58,6 +62,8 @@ namespace OpenGL
  * Each of the following functions uses the currently bound context
  */
 program_t program, color_program;
+/* The vertex buffer shared by all quad_batch_t */
+GLuint quad_vbo = 0;
 GLuint compile_shader(std::string source, GLuint type)
 {
     GLuint shader = GL_CALL(glCreateShader(type));
@@ -113,11 +119,25 @@ void init()
     render_end();
 }
 
+namespace
+{
+void trim_framebuffer_pool(uint32_t max_idle);
+}
+
 void fini()
 {
+    /* Release all pooled framebuffers */
+    trim_framebuffer_pool(0);
+
     render_begin();
     program.free_resources();
     color_program.free_resources();
+    if (quad_vbo)
+    {
+        GL_CALL(glDeleteBuffers(1, &quad_vbo));
+        quad_vbo = 0;
+    }
+
     render_end();
 }
 
@@ -133,10 +153,99 @@ void bind_output(wf::output_t *output, uint32_t fb)
     current_output_fb = fb;
 }
 
+namespace
+{
+/* Pooled framebuffers not borrowed for so many milliseconds are released.
+ * The pool is shared by all outputs, so it is aged by time rather than by the
+ * number of repainted frames. */
+const uint32_t POOL_MAX_IDLE_MS = 1000;
+
+struct pooled_framebuffer_t
+{
+    wf::framebuffer_base_t buffer;
+    uint32_t last_used;
+};
+
+std::vector<pooled_framebuffer_t> framebuffer_pool;
+framebuffer_pool_stats_t pool_stats = {0, 0, 0, 0, 0};
+
+size_t get_framebuffer_size(const wf::framebuffer_base_t& fb)
+{
+    /* RGBA8 */
+    return (size_t)fb.viewport_width * fb.viewport_height * 4;
+}
+
+/** Release the pooled framebuffers which have not been used for max_idle ms */
+void trim_framebuffer_pool(uint32_t max_idle)
+{
+    uint32_t now = wf::get_current_time();
+    auto it = std::remove_if(framebuffer_pool.begin(), framebuffer_pool.end(),
+        [=] (const pooled_framebuffer_t& pooled)
+    {
+        /* Unsigned, so that wrapping around is handled */
+        return now - pooled.last_used >= max_idle;
+    });
+    if (it == framebuffer_pool.end())
+    {
+        return;
+    }
+
+    render_begin();
+    for (auto expired = it; expired != framebuffer_pool.end(); ++expired)
+    {
+        pool_stats.bytes -= get_framebuffer_size(expired->buffer);
+        --pool_stats.pooled;
+        expired->buffer.release();
+    }
+
+    render_end();
+    framebuffer_pool.erase(it, framebuffer_pool.end());
+}
+}
+
 void unbind_output(wf::output_t *output)
 {
     current_output    = NULL;
     current_output_fb = 0;
+
+    trim_framebuffer_pool(POOL_MAX_IDLE_MS);
+}
+
+void borrow_framebuffer(wf::framebuffer_base_t& fb, int width, int height)
+{
+    auto it = std::find_if(framebuffer_pool.begin(), framebuffer_pool.end(),
+        [&] (const pooled_framebuffer_t& pooled)
+    {
+        return (pooled.buffer.viewport_width == width) &&
+        (pooled.buffer.viewport_height == height);
+    });
+
+    ++pool_stats.borrowed;
+    if (it != framebuffer_pool.end())
+    {
+        ++pool_stats.hits;
+        --pool_stats.pooled;
+        fb = std::move(it->buffer);
+        framebuffer_pool.erase(it);
+
+        return;
+    }
+
+    ++pool_stats.misses;
+    fb.allocate(width, height);
+    pool_stats.bytes += get_framebuffer_size(fb);
+}
+
+void return_framebuffer(wf::framebuffer_base_t& fb)
+{
+    --pool_stats.borrowed;
+    ++pool_stats.pooled;
+    framebuffer_pool.push_back({std::move(fb), wf::get_current_time()});
+}
+
+framebuffer_pool_stats_t get_framebuffer_pool_stats()
+{
+    return pool_stats;
 }
 
 void render_transformed_texture(wf::texture_t tex,
@@ -752,4 +861,249 @@ void program_t::deactivate()
     priv->active_attrs.clear();
     GL_CALL(glUseProgram(0));
 }
+
+class quad_batch_t::impl
+{
+  public:
+    struct vertex_t
+    {
+        GLfloat x, y;
+        GLfloat u, v;
+    };
+
+    /** Consecutive vertices drawn with the same state */
+    struct range_t
+    {
+        /* Whether texture is used, or the quads have a single color */
+        bool textured;
+        wf::texture_t texture;
+        glm::vec4 color;
+        GLint first;
+        GLsizei count;
+    };
+
+    std::vector<vertex_t> vertices;
+    std::vector<range_t> ranges;
+
+    glm::mat4 projection;
+    wf::geometry_t fb_geometry;
+    float fb_scale = 1.0;
+
+    /**
+     * Convert the scissor box to the area logic_scissor() would enable, i.e
+     * expand it to whole framebuffer pixels.
+     */
+    gl_geometry get_clip_area(wlr_box scissor) const
+    {
+        scissor.x -= fb_geometry.x;
+        scissor.y -= fb_geometry.y;
+        wlr_box scaled = scissor * fb_scale;
+
+        gl_geometry clip;
+        clip.x1 = fb_geometry.x + scaled.x / fb_scale;
+        clip.y1 = fb_geometry.y + scaled.y / fb_scale;
+        clip.x2 = fb_geometry.x + (scaled.x + scaled.width) / fb_scale;
+        clip.y2 = fb_geometry.y + (scaled.y + scaled.height) / fb_scale;
+
+        return clip;
+    }
+
+    /**
+     * Add the part of the quad inside the scissor box.
+     *
+     * @param g The quad corners, as passed to glDrawArrays() by
+     *   render_transformed_texture(), i.e after inverting.
+     * @param uv The texture coordinates of the corners (g.x1, g.y2),
+     *   (g.x2, g.y2) and (g.x1, g.y1).
+     */
+    void add_quad(const gl_geometry& g, const glm::vec2 uv[3], wlr_box scissor,
+        const range_t& state)
+    {
+        auto clip = get_clip_area(scissor);
+        float x1 = std::max(std::min(g.x1, g.x2), clip.x1);
+        float x2 = std::min(std::max(g.x1, g.x2), clip.x2);
+        float y1 = std::max(std::min(g.y1, g.y2), clip.y1);
+        float y2 = std::min(std::max(g.y1, g.y2), clip.y2);
+        if ((x1 >= x2) || (y1 >= y2))
+        {
+            return;
+        }
+
+        /* Texture coordinates are affine in the (axis-aligned) quad */
+        auto get_vertex = [&] (float x, float y)
+        {
+            glm::vec2 tex = uv[0] +
+                (uv[1] - uv[0]) * ((x - g.x1) / (g.x2 - g.x1)) +
+                (uv[2] - uv[0]) * ((y - g.y2) / (g.y1 - g.y2));
+
+            return vertex_t{x, y, tex.x, tex.y};
+        };
+
+        if (ranges.empty() || !can_merge(ranges.back(), state))
+        {
+            ranges.push_back(state);
+            ranges.back().first = vertices.size();
+            ranges.back().count = 0;
+        }
+
+        vertices.push_back(get_vertex(x1, y2));
+        vertices.push_back(get_vertex(x2, y2));
+        vertices.push_back(get_vertex(x2, y1));
+        vertices.push_back(get_vertex(x1, y2));
+        vertices.push_back(get_vertex(x2, y1));
+        vertices.push_back(get_vertex(x1, y1));
+        ranges.back().count += 6;
+    }
+
+    static bool can_merge(const range_t& a, const range_t& b)
+    {
+        if ((a.textured != b.textured) || (a.color != b.color))
+        {
+            return false;
+        }
+
+        return !a.textured ||
+               ((a.texture.tex_id == b.texture.tex_id) &&
+                (a.texture.target == b.texture.target) &&
+                (a.texture.type == b.texture.type) &&
+                (a.texture.invert_y == b.texture.invert_y));
+    }
+};
+
+quad_batch_t::quad_batch_t()
+{
+    this->priv = std::make_unique<impl>();
+}
+
+quad_batch_t::~quad_batch_t()
+{}
+
+void quad_batch_t::begin(const wf::framebuffer_t& fb)
+{
+    priv->vertices.clear();
+    priv->ranges.clear();
+    priv->projection  = fb.get_orthographic_projection();
+    priv->fb_geometry = fb.geometry;
+    priv->fb_scale    = fb.scale;
+}
+
+void quad_batch_t::add_texture(wf::texture_t texture, const gl_geometry& g,
+    const gl_geometry& texg, wlr_box scissor, glm::vec4 color, uint32_t bits)
+{
+    gl_geometry final_g = g;
+    if (bits & TEXTURE_TRANSFORM_INVERT_Y)
+    {
+        std::swap(final_g.y1, final_g.y2);
+    }
+
+    if (bits & TEXTURE_TRANSFORM_INVERT_X)
+    {
+        std::swap(final_g.x1, final_g.x2);
+    }
+
+    glm::vec2 uv[3] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 1.0f}};
+    if (bits & TEXTURE_USE_TEX_GEOMETRY)
+    {
+        uv[0] = {texg.x1, texg.y2};
+        uv[1] = {texg.x2, texg.y2};
+        uv[2] = {texg.x1, texg.y1};
+    }
+
+    priv->add_quad(final_g, uv, scissor, {true, texture, color, 0, 0});
+}
+
+void quad_batch_t::add_texture(wf::texture_t texture,
+    const wf::geometry_t& geometry, wlr_box scissor, glm::vec4 color,
+    uint32_t bits)
+{
+    bits &= ~TEXTURE_USE_TEX_GEOMETRY;
+
+    gl_geometry gg;
+    gg.x1 = geometry.x;
+    gg.y1 = geometry.y;
+    gg.x2 = gg.x1 + geometry.width;
+    gg.y2 = gg.y1 + geometry.height;
+    add_texture(texture, gg, {}, scissor, color, bits);
+}
+
+void quad_batch_t::add_rectangle(const wf::geometry_t& geometry,
+    wf::color_t color, wlr_box scissor)
+{
+    gl_geometry gg;
+    gg.x1 = geometry.x;
+    gg.y1 = geometry.y;
+    gg.x2 = gg.x1 + geometry.width;
+    gg.y2 = gg.y1 + geometry.height;
+
+    glm::vec2 uv[3] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 1.0f}};
+    glm::vec4 rgba  = {color.r, color.g, color.b, color.a};
+    priv->add_quad(gg, uv, scissor, {false, {}, rgba, 0, 0});
+}
+
+void quad_batch_t::flush()
+{
+    if (priv->vertices.empty())
+    {
+        return;
+    }
+
+    if (!quad_vbo)
+    {
+        GL_CALL(glGenBuffers(1, &quad_vbo));
+    }
+
+    /* Orphan the previous contents, so that the driver does not need to wait
+     * for draws which still use them */
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, quad_vbo));
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER,
+        priv->vertices.size() * sizeof(impl::vertex_t),
+        priv->vertices.data(), GL_STREAM_DRAW));
+
+    GL_CALL(glDisable(GL_SCISSOR_TEST));
+    GL_CALL(glEnable(GL_BLEND));
+    GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+
+    const GLsizei stride = sizeof(impl::vertex_t);
+    const void *uv_offset = (const void*)offsetof(impl::vertex_t, u);
+
+    program_t *active = nullptr;
+    wf::texture_type_t active_type = wf::TEXTURE_TYPE_ALL;
+    for (auto& range : priv->ranges)
+    {
+        program_t *needed = range.textured ? &program : &color_program;
+        auto type = range.textured ? range.texture.type : wf::TEXTURE_TYPE_RGBA;
+        if ((needed != active) || (type != active_type))
+        {
+            if (active)
+            {
+                active->deactivate();
+            }
+
+            active = needed;
+            active_type = type;
+            active->use(type);
+            active->attrib_pointer("position", 2, stride, (const void*)0);
+            if (range.textured)
+            {
+                active->attrib_pointer("uvPosition", 2, stride, uv_offset);
+            }
+
+            active->uniformMatrix4f("MVP", priv->projection);
+        }
+
+        if (range.textured)
+        {
+            active->set_active_texture(range.texture);
+        }
+
+        active->uniform4f("color", range.color);
+        GL_CALL(glDrawArrays(GL_TRIANGLES, range.first, range.count));
+    }
+
+    active->deactivate();
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    priv->vertices.clear();
+    priv->ranges.clear();
+}
 }
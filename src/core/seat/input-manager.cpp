@@ -375,17 +375,15 @@ wf::surface_interface_t*input_manager::input_surface_at(wf::pointf_t global,
     global.x -= og.x;
     global.y -= og.y;
 
-    for (auto& v : output->workspace->get_views_in_layer(wf::VISIBLE_LAYERS))
+    auto& index = ((wf::output_impl_t*)output)->get_input_index();
+    for (auto& view : index.get_views_at(global))
     {
-        for (auto& view : v->enumerate_views())
+        if (!view->minimized && can_focus_surface(view.get()))
         {
-            if (!view->minimized && can_focus_surface(view.get()))
+            auto surface = view->map_input_coordinates(global, local);
+            if (surface)
             {
-                auto surface = view->map_input_coordinates(global, local);
-                if (surface)
-                {
-                    return surface;
-                }
+                return surface;
             }
         }
     }
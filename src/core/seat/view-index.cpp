@@ -0,0 +1,128 @@
+#include "view-index.hpp"
+#include <wayfire/output.hpp>
+#include <wayfire/workspace-manager.hpp>
+#include <wayfire/signal-definitions.hpp>
+#include "../../view/view-impl.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+wf::view_input_index_t::view_input_index_t(wf::output_t *output)
+{
+    this->output = output;
+
+    on_views_changed.set_callback([=] (wf::signal_data_t*)
+    {
+        dirty = true;
+    });
+
+    for (auto signal : {"stack-order-changed", "view-geometry-changed",
+                        "view-mapped", "view-unmapped", "view-disappeared",
+                        "view-minimized", "view-attached", "view-layer-attached",
+                        "view-layer-detached", "output-configuration-changed"})
+    {
+        output->connect_signal(signal, &on_views_changed);
+    }
+
+    /* Subsurfaces change the bounding box of a view without any geometry
+     * signal, but they damage the new area when they do */
+    on_view_damaged.set_callback([=] (wf::signal_data_t *data)
+    {
+        auto ev = static_cast<wf::view_region_damaged_signal*>(data);
+        for (auto& entry : entries)
+        {
+            if ((entry.view == ev->view) && !entry.transformed &&
+                (wf::geometry_intersection(entry.bbox, ev->box) != ev->box))
+            {
+                dirty = true;
+            }
+        }
+    });
+}
+
+void wf::view_input_index_t::rebuild()
+{
+    entries.clear();
+    on_view_damaged.disconnect();
+    for (auto& v :
+         output->workspace->get_views_in_layer_snapshot(wf::VISIBLE_LAYERS))
+    {
+        for (auto& view : v->enumerate_views())
+        {
+            if (view->is_mapped())
+            {
+                entries.push_back({view, view->get_bounding_box(),
+                    view->has_transformer()});
+                view->connect_signal("region-damaged", &on_view_damaged);
+            }
+        }
+    }
+
+    auto og = output->get_relative_geometry();
+    columns = (og.width + cell_size - 1) / cell_size;
+    rows    = (og.height + cell_size - 1) / cell_size;
+
+    /* Keep the cells' storage around, the index is rebuilt often */
+    cells.resize(columns * rows);
+    for (auto& cell : cells)
+    {
+        cell.clear();
+    }
+
+    for (uint32_t i = 0; i < entries.size(); i++)
+    {
+        /* The bounding box of a transformed view can change at any time, so
+         * it is listed in all cells and its bounding box is checked on lookup */
+        auto box = entries[i].transformed ? og :
+            wf::geometry_intersection(entries[i].bbox, og);
+        if ((box.width <= 0) || (box.height <= 0))
+        {
+            continue;
+        }
+
+        int x1 = box.x / cell_size;
+        int y1 = box.y / cell_size;
+        int x2 = (box.x + box.width - 1) / cell_size;
+        int y2 = (box.y + box.height - 1) / cell_size;
+        for (int y = y1; y <= y2; y++)
+        {
+            for (int x = x1; x <= x2; x++)
+            {
+                cells[y * columns + x].push_back(i);
+            }
+        }
+    }
+
+    dirty = false;
+    transformers_generation = get_transformers_generation();
+}
+
+const std::vector<wayfire_view>& wf::view_input_index_t::get_views_at(
+    wf::pointf_t point)
+{
+    if (dirty || (transformers_generation != get_transformers_generation()))
+    {
+        rebuild();
+    }
+
+    views_at.clear();
+
+    int x = std::floor(point.x);
+    int y = std::floor(point.y);
+    if ((x < 0) || (y < 0) ||
+        (x >= columns * cell_size) || (y >= rows * cell_size))
+    {
+        return views_at;
+    }
+
+    for (auto i : cells[(y / cell_size) * columns + x / cell_size])
+    {
+        /* The bounding box may have shrunk since the index was rebuilt */
+        if (entries[i].view->get_bounding_box() & point)
+        {
+            views_at.push_back(entries[i].view);
+        }
+    }
+
+    return views_at;
+}
@@ -0,0 +1,74 @@
+#ifndef WF_SEAT_VIEW_INDEX_HPP
+#define WF_SEAT_VIEW_INDEX_HPP
+
+#include <wayfire/object.hpp>
+#include <wayfire/view.hpp>
+#include <vector>
+
+namespace wf
+{
+/**
+ * A spatial index of the views on an output, used to find the views which
+ * might receive input at a point without checking all of them.
+ *
+ * The output is divided into a uniform grid, and each cell lists the views
+ * whose bounding box intersects it, in stacking order. The index is rebuilt
+ * lazily, when it is queried after the views on the output have changed:
+ * restacking, a geometry change, (un)mapping, minimizing, adding or removing
+ * a transformer, or a view damaging an area outside of its bounding box, i.e
+ * growing because of its subsurfaces.
+ *
+ * The parameters of a transformer can change without any notification, so
+ * views with a transformer are listed in all cells. The bounding box of the
+ * views in a cell is computed again on each lookup.
+ */
+class view_input_index_t
+{
+  public:
+    view_input_index_t(wf::output_t *output);
+
+    /**
+     * Get the mapped views whose bounding box contains the given point,
+     * topmost first. The views still need to be checked with
+     * map_input_coordinates(), since they don't necessarily accept input in
+     * their whole bounding box.
+     *
+     * The returned list is valid until the next call.
+     *
+     * @param point The point, in output-local coordinates.
+     */
+    const std::vector<wayfire_view>& get_views_at(wf::pointf_t point);
+
+  private:
+    wf::output_t *output;
+
+    /* The size of the grid cells, in output-local pixels */
+    static constexpr int cell_size = 128;
+
+    struct entry_t
+    {
+        wayfire_view view;
+        wf::geometry_t bbox;
+        /* Whether the view has a transformer, see the class description */
+        bool transformed;
+    };
+
+    /* All mapped views in stacking order */
+    std::vector<entry_t> entries;
+    /* For each cell, the indices of the entries which intersect it */
+    std::vector<std::vector<uint32_t>> cells;
+    int columns = 0, rows = 0;
+    bool dirty = true;
+    /* The transformers generation when the index was last rebuilt */
+    uint64_t transformers_generation = 0;
+
+    std::vector<wayfire_view> views_at;
+
+    void rebuild();
+
+    wf::signal_connection_t on_views_changed;
+    wf::signal_connection_t on_view_damaged;
+};
+}
+
+#endif /* end of include guard: WF_SEAT_VIEW_INDEX_HPP */
@@ -0,0 +1,219 @@
+#include <wayfire/thread-pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+/** The chunks submitted by a single parallel_for() call */
+struct batch_t
+{
+    const wf::thread_pool_t::range_task_t *task;
+
+    /* Decremented with the mutex held, so that the submitting thread does not
+     * destroy the batch while it is still being signalled */
+    std::atomic<int> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+struct chunk_t
+{
+    batch_t *batch;
+    int begin;
+    int end;
+};
+
+struct work_queue_t
+{
+    std::mutex mutex;
+    std::deque<chunk_t> chunks;
+};
+}
+
+class wf::thread_pool_t::impl
+{
+  public:
+    /* A queue for each worker, and a last one for the submitting threads */
+    std::vector<std::unique_ptr<work_queue_t>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    /* The number of queued chunks which have not been taken yet */
+    std::atomic<int> queued{0};
+    bool stopping = false;
+
+    impl(int num_workers)
+    {
+        if (num_workers < 0)
+        {
+            num_workers =
+                std::max(0, (int)std::thread::hardware_concurrency() - 1);
+        }
+
+        for (int i = 0; i <= num_workers; i++)
+        {
+            queues.push_back(std::make_unique<work_queue_t>());
+        }
+
+        for (int i = 0; i < num_workers; i++)
+        {
+            workers.emplace_back([=] () { worker_loop(i); });
+        }
+    }
+
+    ~impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    /**
+     * Take the oldest chunk from the given queue, or if it is empty, steal the
+     * newest chunk from another queue.
+     *
+     * @return false if all queues are empty.
+     */
+    bool take_chunk(size_t index, chunk_t& chunk)
+    {
+        for (size_t i = 0; i < queues.size(); i++)
+        {
+            auto& queue = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.chunks.empty())
+            {
+                continue;
+            }
+
+            if (i == 0)
+            {
+                chunk = queue.chunks.front();
+                queue.chunks.pop_front();
+            } else
+            {
+                chunk = queue.chunks.back();
+                queue.chunks.pop_back();
+            }
+
+            --queued;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void run_chunk(const chunk_t& chunk)
+    {
+        auto batch = chunk.batch;
+        (*batch->task)(chunk.begin, chunk.end);
+
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (--batch->remaining == 0)
+        {
+            batch->done.notify_all();
+        }
+    }
+
+    void worker_loop(size_t index)
+    {
+        while (true)
+        {
+            chunk_t chunk;
+            if (take_chunk(index, chunk))
+            {
+                run_chunk(chunk);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock, [=] () { return stopping || (queued > 0); });
+            if (stopping)
+            {
+                return;
+            }
+        }
+    }
+
+    void parallel_for(int count, int grain, const range_task_t& task)
+    {
+        grain = std::max(grain, 1);
+        if (count <= 0)
+        {
+            return;
+        }
+
+        if (workers.empty() || (count <= grain))
+        {
+            task(0, count);
+            return;
+        }
+
+        /* Use a few chunks per thread, so that threads which are done early
+         * can steal work from the others */
+        const int threads    = workers.size() + 1;
+        const int chunk_size =
+            std::max(grain, (count + 4 * threads - 1) / (4 * threads));
+        const int num_chunks = (count + chunk_size - 1) / chunk_size;
+
+        batch_t batch;
+        batch.task = &task;
+        batch.remaining = num_chunks;
+        for (int i = 0; i < num_chunks; i++)
+        {
+            auto& queue = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.chunks.push_back({&batch, i * chunk_size,
+                std::min(count, (i + 1) * chunk_size)});
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            queued += num_chunks;
+        }
+
+        wake.notify_all();
+
+        /* Help with the work instead of just waiting for it */
+        chunk_t chunk;
+        while (batch.remaining > 0 && take_chunk(queues.size() - 1, chunk))
+        {
+            run_chunk(chunk);
+        }
+
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&] () { return batch.remaining == 0; });
+    }
+};
+
+wf::thread_pool_t::thread_pool_t(int num_workers)
+{
+    this->pimpl = std::make_unique<impl>(num_workers);
+}
+
+wf::thread_pool_t::~thread_pool_t() = default;
+
+int wf::thread_pool_t::get_num_workers() const
+{
+    return pimpl->workers.size();
+}
+
+void wf::thread_pool_t::parallel_for(int count, int grain,
+    const range_task_t& task)
+{
+    pimpl->parallel_for(count, grain, task);
+}
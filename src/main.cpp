@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <getopt.h>
 #include <signal.h>
@@ -28,6 +29,9 @@ extern "C"
 #include "core/core-impl.hpp"
 #include "view/view-impl.hpp"
 #include "wayfire/output.hpp"
+#include "wayfire/output-layout.hpp"
+#include "wayfire/render-manager.hpp"
+#include "wayfire/option-wrapper.hpp"
 
 wf_runtime_config runtime_config;
 
@@ -57,6 +61,29 @@ static int handle_config_updated(int fd, uint32_t mask, void *data)
     return 0;
 }
 
+static int handle_dump_frame_timings(int signal, void *data)
+{
+    wf::option_wrapper_t<std::string> frame_timing_file{"core/frame_timing_file"};
+
+    std::ofstream out{(std::string)frame_timing_file};
+    if (!out)
+    {
+        LOGE("Failed to open ", (std::string)frame_timing_file,
+            " for writing frame timings");
+
+        return 0;
+    }
+
+    for (auto& wo : wf::get_core().output_layout->get_outputs())
+    {
+        wo->render->dump_frame_timings(out);
+    }
+
+    LOGI("Frame timings written to ", (std::string)frame_timing_file);
+
+    return 0;
+}
+
 static void print_version()
 {
     std::cout << WAYFIRE_VERSION << std::endl;
@@ -248,6 +275,24 @@ static void signal_handler(int signal)
 
 #endif
 
+#ifdef WF_BENCH_HARNESS
+/**
+ * The benchmark harness runs the bench plugin from the build directory on a
+ * single headless output with software rendering. Each of these can still be
+ * overridden from the environment.
+ */
+static void setup_bench_environment()
+{
+    setenv("WLR_BACKENDS", "headless", 0);
+    setenv("WLR_HEADLESS_OUTPUTS", "1", 0);
+    setenv("WLR_LIBINPUT_NO_DEVICES", "1", 0);
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+    setenv("WAYFIRE_PLUGIN_PATH", BENCH_PLUGIN_PATH, 0);
+    setenv("WAYFIRE_PLUGIN_XML_PATH", BENCH_PLUGIN_XML_PATH, 0);
+}
+
+#endif
+
 int main(int argc, char *argv[])
 {
     config_dir = nonull(getenv("XDG_CONFIG_HOME"));
@@ -257,6 +302,10 @@ int main(int argc, char *argv[])
     }
 
     config_file = config_dir + "/wayfire.ini";
+#ifdef WF_BENCH_HARNESS
+    setup_bench_environment();
+    config_file = BENCH_CONFIG_FILE;
+#endif
 
     wf::log::log_level_t log_level = wf::log::LOG_LEVEL_INFO;
     struct option opts[] = {
@@ -320,8 +369,6 @@ int main(int argc, char *argv[])
 #endif
 
     LOGI("Starting wayfire version ", WAYFIRE_VERSION);
-    /* First create display and initialize safe-list's event loop, so that
-     * wf objects (which depend on safe-list) can work */
     auto display = wl_display_create();
     wf::_safe_list_detail::event_loop = wl_display_get_event_loop(display);
 
@@ -365,6 +412,8 @@ int main(int argc, char *argv[])
 
     wl_event_loop_add_fd(core.ev_loop, inotify_fd, WL_EVENT_READABLE,
         handle_config_updated, NULL);
+    wl_event_loop_add_signal(core.ev_loop, SIGUSR1,
+        handle_dump_frame_timings, NULL);
     core.init();
 
     auto server_name = wl_display_add_socket_auto(core.display);
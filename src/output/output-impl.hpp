@@ -1,5 +1,6 @@
 #include "wayfire/output.hpp"
 #include "plugin-loader.hpp"
+#include "../core/seat/view-index.hpp"
 
 #include <unordered_set>
 #include <wayfire/nonstd/safe-list.hpp>
@@ -40,6 +41,7 @@ class output_impl_t : public output_t
     void focus_view(wayfire_view view, uint32_t flags);
 
     wf::dimensions_t effective_size;
+    std::unique_ptr<view_input_index_t> input_index;
 
   public:
     output_impl_t(wlr_output *output, const wf::dimensions_t& effective_size);
@@ -86,5 +88,8 @@ class output_impl_t : public output_t
 
     /** Set the effective resolution of the output */
     void set_effective_size(const wf::dimensions_t& size);
+
+    /** @return The index of the views used for hit-testing input */
+    view_input_index_t& get_input_index();
 };
 }
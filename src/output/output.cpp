@@ -51,7 +51,7 @@ std::string wf::output_t::to_string() const
 void wf::output_impl_t::refocus(wayfire_view skip_view, uint32_t layers)
 {
     wayfire_view next_focus = nullptr;
-    auto views = workspace->get_views_on_workspace(
+    auto views = workspace->get_views_on_workspace_snapshot(
         workspace->get_current_workspace(), layers);
 
     for (auto v : views)
@@ -73,7 +73,7 @@ void wf::output_t::refocus(wayfire_view skip_view)
     uint32_t focused_layer = wf::get_core().get_focused_layer();
     uint32_t layers = focused_layer <= LAYER_WORKSPACE ? WM_LAYERS : focused_layer;
 
-    auto views = workspace->get_views_on_workspace(
+    auto views = workspace->get_views_on_workspace_snapshot(
         workspace->get_current_workspace(), layers);
 
     if (views.empty())
@@ -102,6 +102,16 @@ wf::output_t::~output_t()
 wf::output_impl_t::~output_impl_t()
 {}
 
+wf::view_input_index_t& wf::output_impl_t::get_input_index()
+{
+    if (!input_index)
+    {
+        input_index = std::make_unique<view_input_index_t>(this);
+    }
+
+    return *input_index;
+}
+
 void wf::output_impl_t::set_effective_size(const wf::dimensions_t& size)
 {
     this->effective_size = size;
@@ -309,7 +319,7 @@ void wf::output_impl_t::focus_view(wayfire_view v, bool raise)
 
 wayfire_view wf::output_t::get_top_view() const
 {
-    auto views = workspace->get_views_on_workspace(
+    auto views = workspace->get_views_on_workspace_snapshot(
         workspace->get_current_workspace(),
         LAYER_WORKSPACE);
 
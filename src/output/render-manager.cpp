@@ -4,11 +4,22 @@
 #include "../core/core-impl.hpp"
 #include "wayfire/util.hpp"
 #include "wayfire/workspace-manager.hpp"
+#include "output-impl.hpp"
 #include "../core/seat/input-manager.hpp"
 #include "../core/opengl-priv.hpp"
+#include "../view/surface-impl.hpp"
 #include "../main.hpp"
 #include <algorithm>
-#include <wayfire/nonstd/reverse.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <deque>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <queue>
+#include <unordered_map>
 #include <wayfire/nonstd/safe-list.hpp>
 #include <wayfire/util/log.hpp>
 
@@ -18,8 +29,10 @@ extern "C"
 #define static
 #include <wlr/render/wlr_renderer.h>
 #undef static
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_presentation_time.h>
+#include <wlr/types/wlr_surface.h>
 #include <wlr/util/region.h>
 }
 
@@ -227,6 +240,140 @@ struct output_damage_t
     }
 };
 
+/** Human-readable names of the frame paths, see frame_path_t */
+static const char *frame_path_names[] = {
+    "composited", "fullscreen", "scanout",
+};
+
+/**
+ * Records the duration of the phases of each repainted frame and of the hooks
+ * which run during it, keeping the last core/frame_timing_history frames.
+ */
+struct frame_timing_recorder_t
+{
+    using clock_type = std::chrono::steady_clock;
+
+    wf::option_wrapper_t<int> history_size{"core/frame_timing_history"};
+    std::deque<frame_timing_t> history;
+
+    /* Human-readable names of the registered hooks */
+    std::unordered_map<const void*, std::string> hook_names;
+
+    /* Whether the current frame is being recorded */
+    bool recording = false;
+    frame_timing_t current;
+    clock_type::time_point frame_start;
+    clock_type::time_point phase_start;
+
+    static int64_t elapsed_since(clock_type::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            clock_type::now() - start).count();
+    }
+
+    template<class Hook>
+    void add_hook(Hook *hook)
+    {
+        const char *mangled = hook->target_type().name();
+
+        int status;
+        char *demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+        hook_names[hook] = (status == 0 ? demangled : mangled);
+        free(demangled);
+    }
+
+    /** Register a hook which is not a std::function under the given name */
+    void add_hook(const void *hook, std::string name)
+    {
+        hook_names[hook] = std::move(name);
+    }
+
+    void rem_hook(const void *hook)
+    {
+        hook_names.erase(hook);
+    }
+
+    void start_frame(const timespec& start)
+    {
+        recording = history_size > 0;
+        if (!recording)
+        {
+            history.clear();
+            return;
+        }
+
+        current.start = start;
+        current.total = 0;
+        std::fill(std::begin(current.phases), std::end(current.phases), 0);
+        current.hooks.clear();
+        current.path = FRAME_PATH_COMPOSITED;
+        frame_start = clock_type::now();
+    }
+
+    /** Stop recording a frame which turned out not to be repainted */
+    void cancel_frame()
+    {
+        recording = false;
+    }
+
+    void start_phase()
+    {
+        if (recording)
+        {
+            phase_start = clock_type::now();
+        }
+    }
+
+    void end_phase(frame_phase_t phase)
+    {
+        if (recording)
+        {
+            current.phases[phase] += elapsed_since(phase_start);
+        }
+    }
+
+    template<class Callback>
+    void run_hook(const void *hook, frame_phase_t phase, Callback run)
+    {
+        if (!recording)
+        {
+            run();
+            return;
+        }
+
+        auto start = clock_type::now();
+        run();
+
+        auto it = hook_names.find(hook);
+        current.hooks.push_back({
+            it == hook_names.end() ? "" : it->second,
+            phase, elapsed_since(start)});
+    }
+
+    /**
+     * Finish recording the current frame and store it in the history.
+     *
+     * @return The recorded frame, or nullptr if the frame was not recorded.
+     */
+    const frame_timing_t *end_frame()
+    {
+        if (!recording)
+        {
+            return nullptr;
+        }
+
+        recording     = false;
+        current.total = elapsed_since(frame_start);
+        history.push_back(current);
+        while ((int)history.size() > history_size)
+        {
+            history.pop_front();
+        }
+
+        return &history.back();
+    }
+};
+
 /**
  * Very simple class to manage effect hooks
  */
@@ -235,9 +382,14 @@ struct effect_hook_manager_t
     using effect_container_t = wf::safe_list_t<effect_hook_t*>;
     effect_container_t effects[OUTPUT_EFFECT_TOTAL];
 
+    frame_timing_recorder_t& timing;
+    effect_hook_manager_t(frame_timing_recorder_t& timing) : timing(timing)
+    {}
+
     void add_effect(effect_hook_t *hook, output_effect_type_t type)
     {
         effects[type].push_back(hook);
+        timing.add_hook(hook);
     }
 
     void rem_effect(effect_hook_t *hook)
@@ -246,15 +398,54 @@ struct effect_hook_manager_t
         {
             effects[i].remove_all(hook);
         }
+
+        timing.rem_hook(hook);
     }
 
     void run_effects(output_effect_type_t type)
     {
-        effects[type].for_each([] (auto effect)
-        { (*effect)(); });
+        static const frame_phase_t phase_for_type[] = {
+            FRAME_PHASE_PRE, FRAME_PHASE_OVERLAY, FRAME_PHASE_POST,
+        };
+
+        effects[type].for_each([=] (auto effect)
+        {
+            timing.run_hook(effect, phase_for_type[type], [=] ()
+            {
+                (*effect)();
+            });
+        });
     }
 };
 
+static const char *fused_post_vertex_source =
+    R"(
+#version 100
+
+attribute mediump vec2 position;
+attribute highp vec2 uvPosition;
+
+varying highp vec2 uvpos;
+
+void main() {
+    gl_Position = vec4(position.xy, 0.0, 1.0);
+    uvpos = uvPosition;
+}
+)";
+
+static std::string replace_all(std::string source, const std::string& from,
+    const std::string& to)
+{
+    size_t pos = 0;
+    while ((pos = source.find(from, pos)) != std::string::npos)
+    {
+        source.replace(pos, from.length(), to);
+        pos += to.length();
+    }
+
+    return source;
+}
+
 /**
  * A class to manage and run postprocessing effects
  */
@@ -262,15 +453,39 @@ struct postprocessing_manager_t
 {
     using post_container_t = wf::safe_list_t<post_hook_t*>;
     post_container_t post_effects;
+    using effect_container_t = wf::safe_list_t<post_effect_t*>;
+    effect_container_t fused_effects;
+    /* The programs generated for each combination of fused effects, by the
+     * sources of the effects. Programs which failed to compile have no id. */
+    std::map<std::string, std::unique_ptr<OpenGL::program_t>> fused_programs;
     wf::framebuffer_base_t post_buffers[3];
     /* Buffer to which other operations render to */
     static constexpr uint32_t default_out_buffer = 0;
 
     output_t *output;
     uint32_t output_width, output_height;
-    postprocessing_manager_t(output_t *output)
+    frame_timing_recorder_t& timing;
+    postprocessing_manager_t(output_t *output, frame_timing_recorder_t& timing) :
+        timing(timing)
     {
         this->output = output;
+        timing.add_hook(&fused_effects, "fused post effects");
+    }
+
+    ~postprocessing_manager_t()
+    {
+        OpenGL::render_begin();
+        for (auto& program : fused_programs)
+        {
+            program.second->free_resources();
+        }
+
+        OpenGL::render_end();
+    }
+
+    bool has_post_effects() const
+    {
+        return post_effects.size() || fused_effects.size();
     }
 
     void workaround_wlroots_backend_y_invert(wf::framebuffer_t& fb) const
@@ -296,7 +511,7 @@ struct postprocessing_manager_t
 
     void allocate(int width, int height)
     {
-        if (post_effects.size() == 0)
+        if (!has_post_effects())
         {
             return;
         }
@@ -312,15 +527,171 @@ struct postprocessing_manager_t
     void add_post(post_hook_t *hook)
     {
         post_effects.push_back(hook);
+        timing.add_hook(hook);
         output->render->damage_whole_idle();
     }
 
     void rem_post(post_hook_t *hook)
     {
         post_effects.remove_all(hook);
+        timing.rem_hook(hook);
+        output->render->damage_whole_idle();
+    }
+
+    void add_post_effect(post_effect_t *effect)
+    {
+        fused_effects.push_back(effect);
+        output->render->damage_whole_idle();
+    }
+
+    void rem_post_effect(post_effect_t *effect)
+    {
+        fused_effects.remove_all(effect);
         output->render->damage_whole_idle();
     }
 
+    /** @return The identifier which replaces @name@ in the i-th snippet */
+    static std::string get_effect_name(int i)
+    {
+        return "_wf_effect_" + std::to_string(i);
+    }
+
+    /** Generate and compile a program applying the given effects in order */
+    static GLuint compile_fused_program(const std::vector<post_effect_t*>& effects)
+    {
+        std::string fragment =
+            "#version 100\n"
+            "precision mediump float;\n"
+            "varying highp vec2 uvpos;\n"
+            "uniform sampler2D _wf_source;\n"
+            "uniform highp vec2 wf_resolution;\n";
+        for (size_t i = 0; i < effects.size(); i++)
+        {
+            fragment += replace_all(effects[i]->source, "@name@",
+                get_effect_name(i)) + "\n";
+        }
+
+        /* A warp selects where its input is sampled, so the warps are applied
+         * to the coordinates in reverse order. Color transforms commute with
+         * warps, so they are applied in order after sampling. */
+        fragment += "void main()\n{\n    highp vec2 uv = uvpos;\n";
+        for (int i = effects.size() - 1; i >= 0; i--)
+        {
+            if (effects[i]->stage == POST_EFFECT_UV_WARP)
+            {
+                fragment += "    uv = " + get_effect_name(i) + "(uv);\n";
+            }
+        }
+
+        fragment += "    mediump vec4 color = texture2D(_wf_source, uv);\n";
+        for (size_t i = 0; i < effects.size(); i++)
+        {
+            if (effects[i]->stage == POST_EFFECT_COLOR)
+            {
+                fragment += "    color = " + get_effect_name(i) + "(color);\n";
+            }
+        }
+
+        fragment += "    gl_FragColor = color;\n}\n";
+
+        GLuint program =
+            OpenGL::compile_program(fused_post_vertex_source, fragment);
+        GLint linked = GL_FALSE;
+        GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+        if (linked != GL_TRUE)
+        {
+            LOGE("Failed to compile fused post effects:\n", fragment);
+            GL_CALL(glDeleteProgram(program));
+
+            return 0;
+        }
+
+        return program;
+    }
+
+    /**
+     * @return The program applying the given effects, or nullptr if it could
+     *   not be compiled.
+     */
+    OpenGL::program_t *get_fused_program(
+        const std::vector<post_effect_t*>& effects)
+    {
+        std::string key;
+        for (auto effect : effects)
+        {
+            key += std::to_string(effect->stage) + '\0' + effect->source + '\0';
+        }
+
+        auto it = fused_programs.find(key);
+        if (it == fused_programs.end())
+        {
+            auto program = std::make_unique<OpenGL::program_t>();
+            OpenGL::render_begin();
+            GLuint id = compile_fused_program(effects);
+            if (id)
+            {
+                program->set_simple(id);
+            }
+
+            OpenGL::render_end();
+            it = fused_programs.emplace(key, std::move(program)).first;
+        }
+
+        if (it->second->get_program_id(wf::TEXTURE_TYPE_RGBA) == 0)
+        {
+            return nullptr;
+        }
+
+        return it->second.get();
+    }
+
+    /** Render source to destination with a fused program */
+    void run_fused_pass(OpenGL::program_t& program,
+        const std::vector<post_effect_t*>& effects,
+        const wf::framebuffer_base_t& source,
+        const wf::framebuffer_base_t& destination)
+    {
+        static const float vertexData[] = {
+            -1.0f, -1.0f,
+            1.0f, -1.0f,
+            1.0f, 1.0f,
+            -1.0f, 1.0f
+        };
+
+        static const float coordData[] = {
+            0.0f, 0.0f,
+            1.0f, 0.0f,
+            1.0f, 1.0f,
+            0.0f, 1.0f
+        };
+
+        OpenGL::render_begin(destination);
+        program.use(wf::TEXTURE_TYPE_RGBA);
+        GL_CALL(glActiveTexture(GL_TEXTURE0));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, source.tex));
+        program.uniform1i("_wf_source", 0);
+        program.uniform2f("wf_resolution",
+            destination.viewport_width, destination.viewport_height);
+        for (size_t i = 0; i < effects.size(); i++)
+        {
+            if (effects[i]->set_uniforms)
+            {
+                effects[i]->set_uniforms(program, get_effect_name(i));
+            }
+        }
+
+        program.attrib_pointer("position", 2, 0, vertexData);
+        program.attrib_pointer("uvPosition", 2, 0, coordData);
+
+        GL_CALL(glDisable(GL_BLEND));
+        GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+        GL_CALL(glEnable(GL_BLEND));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+
+        program.deactivate();
+        OpenGL::render_end();
+    }
+
     /* Run all postprocessing effects, rendering to alternating buffers and
      * finally to the screen.
      *
@@ -336,6 +707,62 @@ struct postprocessing_manager_t
         int last_buffer_idx = default_out_buffer;
         int next_buffer_idx = 1;
 
+        /* Run the fused effects as a single pass if possible, otherwise as one
+         * pass for each effect */
+        std::vector<post_effect_t*> effects;
+        fused_effects.for_each([&] (auto effect) { effects.push_back(effect); });
+
+        std::vector<std::vector<post_effect_t*>> passes;
+        if (!effects.empty())
+        {
+            if (get_fused_program(effects))
+            {
+                passes.push_back(effects);
+            } else
+            {
+                for (auto effect : effects)
+                {
+                    if (get_fused_program({effect}))
+                    {
+                        passes.push_back({effect});
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            bool is_last = (i == passes.size() - 1) && (post_effects.size() == 0);
+            wf::framebuffer_base_t& next_buffer = (is_last ?
+                default_framebuffer : post_buffers[next_buffer_idx]);
+
+            OpenGL::render_begin();
+            next_buffer.allocate(output_width, output_height);
+            OpenGL::render_end();
+
+            timing.run_hook(&fused_effects, FRAME_PHASE_POST_EFFECTS, [&] ()
+            {
+                run_fused_pass(*get_fused_program(passes[i]), passes[i],
+                    post_buffers[last_buffer_idx], next_buffer);
+            });
+
+            last_buffer_idx  = next_buffer_idx;
+            next_buffer_idx ^= 0b11; // alternate 1 and 2
+        }
+
+        /* All fused effects failed to compile, just copy the image */
+        if (!effects.empty() && passes.empty() && (post_effects.size() == 0))
+        {
+            OpenGL::render_begin();
+            default_framebuffer.allocate(output_width, output_height);
+            GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER,
+                post_buffers[default_out_buffer].fb));
+            GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, output_fb));
+            GL_CALL(glBlitFramebuffer(0, 0, output_width, output_height,
+                0, 0, output_width, output_height, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+            OpenGL::render_end();
+        }
+
         post_effects.for_each([&] (auto post) -> void
         {
             /* The last postprocessing hook renders directly to the screen, others to
@@ -349,7 +776,10 @@ struct postprocessing_manager_t
             next_buffer.allocate(output_width, output_height);
             OpenGL::render_end();
 
-            (*post)(post_buffers[last_buffer_idx], next_buffer);
+            timing.run_hook(post, FRAME_PHASE_POST_EFFECTS, [&] ()
+            {
+                (*post)(post_buffers[last_buffer_idx], next_buffer);
+            });
 
             last_buffer_idx  = next_buffer_idx;
             next_buffer_idx ^= 0b11; // alternate 1 and 2
@@ -365,7 +795,7 @@ struct postprocessing_manager_t
             (wl_output_transform)fb.wl_transform);
         fb.scale = output->handle->scale;
 
-        if (post_effects.size())
+        if (has_post_effects())
         {
             fb.fb  = post_buffers[default_out_buffer].fb;
             fb.tex = post_buffers[default_out_buffer].tex;
@@ -492,70 +922,738 @@ class depth_buffer_manager_t : public noncopyable_t
     std::vector<depth_buffer_t> buffers;
 };
 
-class wf::render_manager::impl
+/**
+ * Manages the buffers of the workspace streams started by plugins.
+ *
+ * Running streams are registered when they are first updated. When a stream is
+ * stopped, its buffer is kept as an idle buffer, which is reused by the next
+ * stream which needs a buffer of the same size.
+ *
+ * Only idle buffers are ever released: those which have not been used for
+ * core/stream_idle_timeout, and the least recently used ones when the buffers
+ * need more than core/stream_memory_budget. The budget is enforced before a
+ * buffer is allocated. Buffers used in the last few frames are kept, so that
+ * a stream which is stopped and started again right away keeps its contents.
+ *
+ * The running streams are only identified by their address, they are never
+ * accessed after workspace_stream_update() returns.
+ */
+class stream_buffer_manager_t : public noncopyable_t
 {
   public:
-    wf::wl_listener_wrapper on_frame;
-    wf::wl_listener_wrapper on_present;
-    wf::wl_timer repaint_timer;
-    int64_t refresh_nsec = 0;
+    stream_buffer_manager_t()
+    {
+        memory_budget_opt.set_callback([=] () { enforce_budget(0); });
+        idle_timeout_opt.set_callback([=] () { schedule_idle_release(); });
+    }
 
-    output_t *output;
-    wf::region_t swap_damage;
-    std::unique_ptr<output_damage_t> output_damage;
-    std::unique_ptr<effect_hook_manager_t> effects;
-    std::unique_ptr<postprocessing_manager_t> postprocessing;
-    std::unique_ptr<depth_buffer_manager_t> depth_buffer_manager;
+    ~stream_buffer_manager_t()
+    {
+        OpenGL::render_begin();
+        for (auto& buffer : idle)
+        {
+            buffer.buffer.release();
+        }
 
-    wf::option_wrapper_t<wf::color_t> background_color_opt;
-    wf::option_wrapper_t<int> max_render_time_opt;
+        OpenGL::render_end();
+    }
 
-    impl(output_t *o) :
-        output(o)
+    /** Start a new frame */
+    void next_frame()
     {
-        output_damage = std::make_unique<output_damage_t>(o);
-        effects = std::make_unique<effect_hook_manager_t>();
-        postprocessing = std::make_unique<postprocessing_manager_t>(o);
-        depth_buffer_manager = std::make_unique<depth_buffer_manager_t>();
+        ++frame;
+    }
 
-        on_present.set_callback([&] (void *data)
+    /**
+     * Make sure the stream has a buffer of the given size.
+     *
+     * @return true if the contents of the buffer are undefined, i.e it has been
+     *   allocated or resized.
+     */
+    bool allocate(workspace_stream_t& stream, int width, int height)
+    {
+        auto it = std::find_if(running.begin(), running.end(),
+            [&] (const running_stream_t& entry)
         {
-            auto ev = static_cast<wlr_output_event_present*>(data);
-            this->refresh_nsec = ev->refresh;
+            return entry.stream == &stream;
         });
-        on_present.connect(&output->handle->events.present);
+        if (it == running.end())
+        {
+            running.push_back({&stream});
+            it = std::prev(running.end());
+        }
 
-        max_render_time_opt.load_option("core/max_render_time");
-        on_frame.set_callback([&] (void*)
+        bool fresh = (stream.buffer.fb == (uint32_t)-1);
+        if (fresh)
         {
-            /*
-             * Leave a bit of time for clients to render, see
-             * https://github.com/swaywm/sway/pull/4588
-             */
-            int64_t total = this->refresh_nsec / 1000000 - max_render_time_opt;
-            if ((total <= 0) || (max_render_time_opt <= 0) || this->renderer)
-            {
-                total = 0;
-            }
+            take_idle_buffer(stream.buffer, width, height);
+        }
 
-            // We cannot really wait less than 1ms, render right away in that case
-            if (total < 1)
-            {
-                paint();
-            } else
-            {
-                output->handle->frame_pending = true;
-                repaint_timer.set_timeout(total, [=] ()
-                {
-                    output->handle->frame_pending = false;
-                    paint();
-                });
-            }
-        });
-        on_frame.connect(&output_damage->damage_manager->events.frame);
+        bool resized = false;
+        if ((stream.buffer.viewport_width != width) ||
+            (stream.buffer.viewport_height != height) ||
+            (stream.buffer.fb == (uint32_t)-1))
+        {
+            /* Make room for the new buffer before allocating it */
+            it->bytes = 0;
+            enforce_budget((size_t)width * height * 4);
 
-        init_default_streams();
+            OpenGL::render_begin();
+            resized = stream.buffer.allocate(width, height);
+            OpenGL::render_end();
+        }
 
+        it->bytes = get_size(stream.buffer);
+        if (fresh || resized)
+        {
+            schedule_idle_release();
+        }
+
+        return fresh || resized;
+    }
+
+    /** Keep the buffer of the stopped stream as an idle buffer */
+    void stop(workspace_stream_t& stream)
+    {
+        auto it = std::find_if(running.begin(), running.end(),
+            [&] (const running_stream_t& entry)
+        {
+            return entry.stream == &stream;
+        });
+        if (it == running.end())
+        {
+            return;
+        }
+
+        running.erase(it);
+        if (stream.buffer.fb != (uint32_t)-1)
+        {
+            idle.push_back({std::move(stream.buffer), get_current_time(), frame});
+            enforce_budget(0);
+            schedule_idle_release();
+        }
+    }
+
+    stream_memory_usage_t get_usage() const
+    {
+        stream_memory_usage_t usage;
+        usage.buffers = usage.idle_buffers = 0;
+        usage.bytes   = 0;
+        usage.budget  = get_budget();
+
+        for (auto& entry : running)
+        {
+            if (entry.bytes)
+            {
+                ++usage.buffers;
+                usage.bytes += entry.bytes;
+            }
+        }
+
+        for (auto& entry : idle)
+        {
+            ++usage.buffers;
+            ++usage.idle_buffers;
+            usage.bytes += get_size(entry.buffer);
+        }
+
+        return usage;
+    }
+
+  private:
+    wf::option_wrapper_t<int> memory_budget_opt{"core/stream_memory_budget"};
+    wf::option_wrapper_t<int> idle_timeout_opt{"core/stream_idle_timeout"};
+
+    /* Idle buffers used in this many last frames are never released */
+    static constexpr uint64_t keep_frames = 60;
+
+    struct running_stream_t
+    {
+        /* Never dereferenced, see the class description */
+        const workspace_stream_t *stream;
+        /* The size of the stream's buffer when it was last updated */
+        size_t bytes = 0;
+    };
+
+    struct idle_buffer_t
+    {
+        wf::framebuffer_base_t buffer;
+        int64_t last_used;
+        uint64_t last_frame;
+    };
+
+    std::vector<running_stream_t> running;
+    std::vector<idle_buffer_t> idle;
+    uint64_t frame = 0;
+    wf::wl_timer idle_timer;
+
+    static size_t get_size(const wf::framebuffer_base_t& buffer)
+    {
+        if (buffer.fb == (uint32_t)-1)
+        {
+            return 0;
+        }
+
+        /* RGBA8 */
+        return (size_t)buffer.viewport_width * buffer.viewport_height * 4;
+    }
+
+    size_t get_budget() const
+    {
+        return (size_t)std::max(0, (int)memory_budget_opt) * 1024 * 1024;
+    }
+
+    /** Move an idle buffer with the given size to buffer, if there is one */
+    void take_idle_buffer(wf::framebuffer_base_t& buffer, int width, int height)
+    {
+        for (auto it = idle.begin(); it != idle.end(); ++it)
+        {
+            if ((it->buffer.viewport_width == width) &&
+                (it->buffer.viewport_height == height))
+            {
+                buffer = std::move(it->buffer);
+                idle.erase(it);
+
+                return;
+            }
+        }
+    }
+
+    /**
+     * Release the least recently used idle buffer which was last used before
+     * used_before, and not in the last keep_frames frames.
+     *
+     * @return false if there was no buffer to release.
+     */
+    bool release_lru_buffer(int64_t used_before)
+    {
+        auto oldest = idle.end();
+        for (auto it = idle.begin(); it != idle.end(); ++it)
+        {
+            if ((it->last_used < used_before) &&
+                (it->last_frame + keep_frames <= frame) &&
+                ((oldest == idle.end()) || (it->last_used < oldest->last_used)))
+            {
+                oldest = it;
+            }
+        }
+
+        if (oldest == idle.end())
+        {
+            return false;
+        }
+
+        OpenGL::render_begin();
+        oldest->buffer.release();
+        OpenGL::render_end();
+        idle.erase(oldest);
+
+        return true;
+    }
+
+    /** Release idle buffers until another buffer of the given size fits in the
+     * budget */
+    void enforce_budget(size_t needed)
+    {
+        size_t budget = get_budget();
+        if (budget == 0)
+        {
+            return;
+        }
+
+        while (get_usage().bytes + needed > budget)
+        {
+            if (!release_lru_buffer(std::numeric_limits<int64_t>::max()))
+            {
+                LOGD("Workspace stream buffers exceed the memory budget, ",
+                    "but all of them are in use");
+                break;
+            }
+        }
+    }
+
+    /** Release expired buffers, and wait for the next buffer to expire */
+    void schedule_idle_release()
+    {
+        int timeout = idle_timeout_opt;
+        if (timeout <= 0)
+        {
+            idle_timer.disconnect();
+
+            return;
+        }
+
+        int64_t now = get_current_time();
+        while (release_lru_buffer(now - timeout))
+        {}
+
+        /* Wake up when the oldest remaining buffer expires. Buffers kept
+         * because of keep_frames are checked again after another timeout. */
+        int64_t oldest = std::numeric_limits<int64_t>::max();
+        for (auto& entry : idle)
+        {
+            int64_t expires = entry.last_used + timeout;
+            oldest = std::min(oldest, (expires > now) ? expires : now + timeout);
+        }
+
+        if (oldest == std::numeric_limits<int64_t>::max())
+        {
+            idle_timer.disconnect();
+
+            return;
+        }
+
+        idle_timer.set_timeout(std::max<int64_t>(1, oldest - now),
+            [=] () { schedule_idle_release(); });
+    }
+};
+
+/**
+ * Merges the rectangles of fragmented damage, so that fewer rectangles have to
+ * be scissored and drawn, at the cost of repainting some undamaged pixels.
+ *
+ * Each rectangle is assumed to cost as much as core/damage_rect_cost pixels.
+ * Damage with more than core/damage_rect_limit rectangles is simplified by
+ * merging nearby rectangles into their bounding box, cheapest merge first.
+ * Merges which add fewer pixels than a rectangle costs are always done. While
+ * there are too many rectangles, the cheapest merges continue until the
+ * damage would grow by more than core/damage_max_overdraw percent.
+ */
+class damage_simplifier_t : public noncopyable_t
+{
+  public:
+    /** Simplify the region in place, and count it in the statistics */
+    void simplify(wf::region_t& damage)
+    {
+        int limit = rect_limit_opt;
+        auto before = count_rects(damage);
+        ++stats.regions;
+        stats.rects_before += before.first;
+        stats.pixels_before += before.second;
+        if ((limit <= 0) || (before.first <= limit))
+        {
+            stats.rects_after  += before.first;
+            stats.pixels_after += before.second;
+
+            return;
+        }
+
+        std::vector<wlr_box> boxes;
+        for (const auto& rect : damage)
+        {
+            boxes.push_back(wlr_box_from_pixman_box(rect));
+        }
+
+        int64_t max_pixels = before.second *
+            (100 + std::max(0, (int)max_overdraw_opt)) / 100;
+        merge_boxes(boxes, limit, before.second, max_pixels);
+
+        damage.clear();
+        for (const auto& box : boxes)
+        {
+            damage |= box;
+        }
+
+        auto after = count_rects(damage);
+        ++stats.simplified;
+        stats.rects_after  += after.first;
+        stats.pixels_after += after.second;
+    }
+
+    damage_stats_t get_stats() const
+    {
+        return stats;
+    }
+
+  private:
+    /* How many of the following rectangles are considered for a merge. The
+     * rectangles are sorted by bands, so these are usually close by. */
+    static constexpr size_t MERGE_WINDOW = 16;
+
+    wf::option_wrapper_t<int> rect_limit_opt{"core/damage_rect_limit"};
+    wf::option_wrapper_t<int> rect_cost_opt{"core/damage_rect_cost"};
+    wf::option_wrapper_t<int> max_overdraw_opt{"core/damage_max_overdraw"};
+
+    damage_stats_t stats = {0, 0, 0, 0, 0, 0};
+
+    static int64_t area(const wlr_box& box)
+    {
+        return (int64_t)box.width * box.height;
+    }
+
+    static wlr_box bounding_box(const wlr_box& a, const wlr_box& b)
+    {
+        int x1 = std::min(a.x, b.x);
+        int y1 = std::min(a.y, b.y);
+        int x2 = std::max(a.x + a.width, b.x + b.width);
+        int y2 = std::max(a.y + a.height, b.y + b.height);
+
+        return {x1, y1, x2 - x1, y2 - y1};
+    }
+
+    /** @return The number of rectangles and pixels of the region */
+    static std::pair<int, int64_t> count_rects(const wf::region_t& region)
+    {
+        std::pair<int, int64_t> result = {0, 0};
+        for (const auto& rect : region)
+        {
+            ++result.first;
+            result.second += (int64_t)(rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+        }
+
+        return result;
+    }
+
+    /** A possible merge of boxes a and b, valid while both are unchanged */
+    struct merge_t
+    {
+        /* The pixels added by the merge */
+        int64_t extra;
+        size_t a, b;
+        uint32_t version_a, version_b;
+
+        bool operator >(const merge_t& other) const
+        {
+            return extra > other.extra;
+        }
+    };
+
+    /**
+     * Merge boxes in place, always doing the cheapest possible merge next.
+     * The pixels are the sum of the areas of the boxes, which overestimates
+     * the damage once merged boxes overlap.
+     *
+     * Each box is only merged with the MERGE_WINDOW boxes before and after it,
+     * and each merge adds at most 2 * MERGE_WINDOW candidates, so this takes
+     * O(n * MERGE_WINDOW * log n) time for n boxes.
+     */
+    void merge_boxes(std::vector<wlr_box>& boxes, int limit, int64_t pixels,
+        int64_t max_pixels)
+    {
+        int64_t rect_cost = std::max(0, (int)rect_cost_opt);
+        const size_t n    = boxes.size();
+
+        /* The boxes which were not merged into another box, as a linked list
+         * in their original order. n marks the ends of the list. */
+        std::vector<size_t> next(n), prev(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            next[i] = i + 1;
+            prev[i] = (i == 0) ? n : i - 1;
+        }
+
+        std::vector<bool> removed(n, false);
+        /* Incremented when a box grows, so that its old merges are skipped */
+        std::vector<uint32_t> version(n, 0);
+
+        std::priority_queue<merge_t, std::vector<merge_t>,
+            std::greater<merge_t>> candidates;
+        auto add_candidate = [&] (size_t a, size_t b)
+        {
+            int64_t extra = area(bounding_box(boxes[a], boxes[b])) -
+                area(boxes[a]) - area(boxes[b]);
+            candidates.push({extra, a, b, version[a], version[b]});
+        };
+
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t j = next[i];
+            for (size_t k = 0; (j < n) && (k < MERGE_WINDOW); k++, j = next[j])
+            {
+                add_candidate(i, j);
+            }
+        }
+
+        int count = n;
+        while (!candidates.empty() && (count > 1))
+        {
+            auto merge = candidates.top();
+            candidates.pop();
+            if (removed[merge.a] || removed[merge.b] ||
+                (version[merge.a] != merge.version_a) ||
+                (version[merge.b] != merge.version_b))
+            {
+                continue;
+            }
+
+            /* All other merges add at least as many pixels */
+            bool worth_it = merge.extra <= rect_cost;
+            bool too_many = (count > limit) &&
+                (pixels + merge.extra <= max_pixels);
+            if (!worth_it && !too_many)
+            {
+                break;
+            }
+
+            boxes[merge.a] = bounding_box(boxes[merge.a], boxes[merge.b]);
+            ++version[merge.a];
+            removed[merge.b] = true;
+            if (prev[merge.b] < n)
+            {
+                next[prev[merge.b]] = next[merge.b];
+            }
+
+            if (next[merge.b] < n)
+            {
+                prev[next[merge.b]] = prev[merge.b];
+            }
+
+            pixels += merge.extra;
+            --count;
+
+            /* The grown box may now be merged more cheaply with its neighbours */
+            size_t j = next[merge.a];
+            for (size_t k = 0; (j < n) && (k < MERGE_WINDOW); k++, j = next[j])
+            {
+                add_candidate(merge.a, j);
+            }
+
+            j = prev[merge.a];
+            for (size_t k = 0; (j < n) && (k < MERGE_WINDOW); k++, j = prev[j])
+            {
+                add_candidate(j, merge.a);
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            if (!removed[i])
+            {
+                boxes[kept++] = boxes[i];
+            }
+        }
+
+        boxes.resize(kept);
+    }
+};
+
+/**
+ * Chooses how long the repaint is delayed after a frame event, so that clients
+ * have as much time as possible to render, while the repaint still finishes
+ * before the next vblank.
+ *
+ * With core/adaptive_render_delay, the time reserved for the repaint is the
+ * core/render_time_percentile of the recent repaint durations, plus
+ * core/render_time_margin. Each frame which misses its vblank reserves another
+ * millisecond, which is given back after a while without misses. Otherwise,
+ * core/max_render_time is reserved.
+ */
+class render_delay_controller_t : public noncopyable_t
+{
+  public:
+    /**
+     * Called when a frame event arrives.
+     *
+     * @param refresh_nsec The refresh period of the output.
+     * @return The time to wait before repainting, in milliseconds.
+     */
+    int64_t on_frame(int64_t refresh_nsec)
+    {
+        clock_gettime(get_presentation_clock(), &frame_event);
+
+        int64_t refresh_ms = refresh_nsec / 1000000;
+        render_time = adaptive_opt ? get_adaptive_render_time(refresh_ms) :
+            (int)max_render_time_opt;
+        delay = std::max<int64_t>(0, refresh_ms - render_time);
+        if ((refresh_ms <= 0) || (render_time <= 0))
+        {
+            delay = 0;
+        }
+
+        return delay;
+    }
+
+    /** Record the duration of a repaint which was started by a frame event */
+    void frame_repainted(int64_t duration_us)
+    {
+        durations.push_back(duration_us);
+        while (durations.size() > HISTORY_SIZE)
+        {
+            durations.pop_front();
+        }
+
+        awaiting_present = true;
+    }
+
+    /** Check whether the last repainted frame was presented in time */
+    void frame_presented(const wlr_output_event_present& ev)
+    {
+        if (!awaiting_present || !ev.presented || !ev.when || (ev.refresh <= 0))
+        {
+            return;
+        }
+
+        awaiting_present = false;
+        int64_t latency = (ev.when->tv_sec - frame_event.tv_sec) * 1000000000ll +
+            (ev.when->tv_nsec - frame_event.tv_nsec);
+
+        /* The frame should be presented on the vblank after the frame event */
+        bool missed = latency > ev.refresh * 3 / 2;
+        results.push_back(missed);
+        while (results.size() > HISTORY_SIZE)
+        {
+            results.pop_front();
+        }
+
+        if (missed)
+        {
+            ++missed_frames;
+            ++backoff;
+            frames_since_miss = 0;
+            LOGD("Frame missed its vblank by ",
+                (latency - ev.refresh) / 1000, "us, render delay was ",
+                delay, "ms");
+        } else if ((++frames_since_miss >= BACKOFF_DECAY_FRAMES) && (backoff > 0))
+        {
+            --backoff;
+            frames_since_miss = 0;
+        }
+    }
+
+    render_delay_stats_t get_stats() const
+    {
+        render_delay_stats_t stats;
+        stats.delay = delay;
+        stats.render_time   = render_time;
+        stats.missed_frames = missed_frames;
+        stats.miss_rate     = results.empty() ? 0.0 :
+            1.0 * std::count(results.begin(), results.end(), true) /
+            results.size();
+
+        return stats;
+    }
+
+  private:
+    /* The number of frames whose durations and results are kept */
+    static constexpr size_t HISTORY_SIZE = 120;
+    /* The number of durations needed before the delay is adapted */
+    static constexpr size_t MIN_SAMPLES = 10;
+    /* The number of frames without misses after which backoff decreases */
+    static constexpr int BACKOFF_DECAY_FRAMES = 120;
+
+    wf::option_wrapper_t<bool> adaptive_opt{"core/adaptive_render_delay"};
+    wf::option_wrapper_t<int> max_render_time_opt{"core/max_render_time"};
+    wf::option_wrapper_t<int> percentile_opt{"core/render_time_percentile"};
+    wf::option_wrapper_t<int> margin_opt{"core/render_time_margin"};
+
+    /* The durations of the last repaints, in microseconds */
+    std::deque<int64_t> durations;
+    /* Whether each of the last frames missed its vblank */
+    std::deque<bool> results;
+
+    timespec frame_event = {0, 0};
+    bool awaiting_present = false;
+
+    int64_t delay   = 0;
+    int render_time = 0;
+    int backoff     = 0;
+    int frames_since_miss  = 0;
+    uint64_t missed_frames = 0;
+
+    static clockid_t get_presentation_clock()
+    {
+        return wlr_backend_get_presentation_clock(wf::get_core_impl().backend);
+    }
+
+    /** @return The time to reserve for the repaint, in milliseconds */
+    int get_adaptive_render_time(int64_t refresh_ms)
+    {
+        /* Repaint right away until there are enough samples */
+        if (durations.size() < MIN_SAMPLES)
+        {
+            return refresh_ms;
+        }
+
+        std::vector<int64_t> sorted{durations.begin(), durations.end()};
+        int percentile = wf::clamp((int)percentile_opt, 1, 100);
+        auto nth = sorted.begin() + (sorted.size() - 1) * percentile / 100;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+
+        backoff = std::min<int>(backoff, refresh_ms);
+        int render_ms = std::ceil(*nth / 1000.0);
+
+        return render_ms + std::max(0, (int)margin_opt) + backoff;
+    }
+};
+
+class wf::render_manager::impl
+{
+  public:
+    wf::wl_listener_wrapper on_frame;
+    wf::wl_listener_wrapper on_present;
+    wf::wl_timer repaint_timer;
+    int64_t refresh_nsec = 0;
+
+    output_t *output;
+    wf::region_t swap_damage;
+    std::unique_ptr<output_damage_t> output_damage;
+    frame_timing_recorder_t frame_timing;
+    std::unique_ptr<effect_hook_manager_t> effects;
+    std::unique_ptr<postprocessing_manager_t> postprocessing;
+    std::unique_ptr<depth_buffer_manager_t> depth_buffer_manager;
+    stream_buffer_manager_t stream_buffers;
+    render_delay_controller_t render_delay;
+    damage_simplifier_t damage_simplifier;
+
+    wf::option_wrapper_t<wf::color_t> background_color_opt;
+    wf::option_wrapper_t<int> occluded_frame_rate_opt;
+    wf::option_wrapper_t<bool> direct_scanout_opt{"core/direct_scanout"};
+
+    /* The number of frames repainted through each path, and the path of the
+     * last repainted frame */
+    uint64_t frame_counts[FRAME_PATH_TOTAL] = {0};
+    frame_path_t last_frame_path = FRAME_PATH_COMPOSITED;
+
+    impl(output_t *o) :
+        output(o)
+    {
+        output_damage = std::make_unique<output_damage_t>(o);
+        effects = std::make_unique<effect_hook_manager_t>(frame_timing);
+        postprocessing =
+            std::make_unique<postprocessing_manager_t>(o, frame_timing);
+        depth_buffer_manager = std::make_unique<depth_buffer_manager_t>();
+
+        on_present.set_callback([&] (void *data)
+        {
+            auto ev = static_cast<wlr_output_event_present*>(data);
+            this->refresh_nsec = ev->refresh;
+            render_delay.frame_presented(*ev);
+        });
+        on_present.connect(&output->handle->events.present);
+
+        on_frame.set_callback([&] (void*)
+        {
+            /*
+             * Leave a bit of time for clients to render, see
+             * https://github.com/swaywm/sway/pull/4588
+             */
+            int64_t total = render_delay.on_frame(this->refresh_nsec);
+            if (this->renderer)
+            {
+                total = 0;
+            }
+
+            // We cannot really wait less than 1ms, render right away in that case
+            if (total < 1)
+            {
+                timed_paint();
+            } else
+            {
+                output->handle->frame_pending = true;
+                repaint_timer.set_timeout(total, [=] ()
+                {
+                    output->handle->frame_pending = false;
+                    timed_paint();
+                });
+            }
+        });
+        on_frame.connect(&output_damage->damage_manager->events.frame);
+
+        init_default_streams();
+        init_retained_views();
+
+        occluded_frame_rate_opt.load_option("core/occluded_frame_rate");
         background_color_opt.load_option("core/background_color");
         background_color_opt.set_callback([=] ()
         {
@@ -585,6 +1683,91 @@ class wf::render_manager::impl
         }
     }
 
+    /**
+     * A view in a retained view list, together with the result of the
+     * visibility check at the time the list was built.
+     */
+    struct retained_view_t
+    {
+        wayfire_view view;
+        bool visible;
+    };
+
+    /**
+     * The views in the visible layers in stacking order, as seen from a
+     * workspace. The list is kept between frames and rebuilt only after it
+     * has been invalidated by a change of the stacking order, the geometry of
+     * a view or the mapped state of a view.
+     */
+    struct retained_view_list_t
+    {
+        std::vector<retained_view_t> views;
+        bool dirty = true;
+    };
+
+    /* A retained view list for each workspace */
+    std::vector<std::vector<retained_view_list_t>> retained_views;
+
+    wf::signal_connection_t on_retained_views_changed = {[=] (signal_data_t*)
+        {
+            for (auto& column : retained_views)
+            {
+                for (auto& list : column)
+                {
+                    list.dirty = true;
+                }
+            }
+        }
+    };
+
+    void init_retained_views()
+    {
+        auto wsize = output->workspace->get_workspace_grid_size();
+        retained_views.resize(wsize.width);
+        for (auto& column : retained_views)
+        {
+            column.resize(wsize.height);
+        }
+
+        for (auto signal : {"stack-order-changed", "view-geometry-changed",
+                            "view-mapped", "view-unmapped", "workspace-changed",
+                            "output-configuration-changed"})
+        {
+            output->connect_signal(signal, &on_retained_views_changed);
+        }
+    }
+
+    /**
+     * Transformed views can become visible on a workspace without changing
+     * their geometry, and views which are not backed by a wlr_surface do not
+     * report geometry changes on the output, so their visibility cannot be
+     * cached.
+     */
+    bool needs_visibility_recheck(wayfire_view view)
+    {
+        return view->has_transformer() || !view->get_wlr_surface();
+    }
+
+    /** @return The up-to-date retained view list for the given workspace */
+    retained_view_list_t& get_retained_views(wf::point_t ws)
+    {
+        auto& list = retained_views[ws.x][ws.y];
+        if (list.dirty)
+        {
+            list.views.clear();
+            for (auto& view : output->workspace->get_views_in_layer_snapshot(
+                wf::VISIBLE_LAYERS))
+            {
+                list.views.push_back(
+                    {view, output->workspace->view_visible_on(view, ws)});
+            }
+
+            list.dirty = false;
+        }
+
+        return list;
+    }
+
     render_hook_t renderer;
     void set_renderer(render_hook_t rh)
     {
@@ -635,72 +1818,259 @@ class wf::render_manager::impl
     {
         OpenGL::bind_output(output, fb);
 
-        /* Make sure the default buffer has enough size */
-        postprocessing->allocate(output->handle->width, output->handle->height);
+        /* Make sure the default buffer has enough size */
+        postprocessing->allocate(output->handle->width, output->handle->height);
+    }
+
+    /**
+     * The default renderer, which just makes sure the correct workspace stream
+     * is drawn to the framebuffer
+     */
+    void default_renderer()
+    {
+        if (runtime_config.damage_debug)
+        {
+            /* Clear the screen to yellow, so that the repainted parts are
+             * visible */
+            swap_damage |= output_damage->get_wlr_damage_box();
+
+            OpenGL::render_begin(output->handle->width, output->handle->height,
+                postprocessing->output_fb);
+            OpenGL::clear({1, 1, 0, 1});
+            OpenGL::render_end();
+        }
+
+        auto cws = output->workspace->get_current_workspace();
+        auto target_stream = &default_streams[cws.x][cws.y];
+        if (current_ws_stream.get() != target_stream)
+        {
+            if (current_ws_stream)
+            {
+                workspace_stream_stop(*current_ws_stream);
+            }
+
+            current_ws_stream = nonstd::make_observer(target_stream);
+            workspace_stream_start(*current_ws_stream);
+        } else
+        {
+            workspace_stream_update(*current_ws_stream);
+        }
+    }
+
+    /**
+     * Return the swap damage if called from overlay or postprocessing
+     * effect callbacks or empty region otherwise.
+     */
+    wf::region_t get_swap_damage()
+    {
+        return swap_damage;
+    }
+
+    /**
+     * Render an output. Either calls the built-in renderer, or the render hook
+     * of a plugin
+     */
+    void render_output(wayfire_view fullscreen_view)
+    {
+        if (renderer)
+        {
+            renderer(postprocessing->get_target_framebuffer());
+            /* TODO: let custom renderers specify what they want to repaint... */
+            swap_damage |= output_damage->get_wlr_damage_box();
+        } else
+        {
+            swap_damage =
+                output_damage->get_scheduled_damage() * output->handle->scale;
+            swap_damage &= output_damage->get_wlr_damage_box();
+            if (fullscreen_view)
+            {
+                render_fullscreen_view(fullscreen_view);
+            } else
+            {
+                default_renderer();
+            }
+        }
+    }
+
+    /**
+     * Find the view which hides everything else on the output, so that the
+     * rest of the scene does not need to be composited. This is the case when
+     * the topmost view on the current workspace is a fullscreen view which is
+     * mapped, untransformed and opaque on the whole output, and nothing is
+     * drawn on top of the views (render hooks, overlays, post effects, grabs).
+     *
+     * @return The fullscreen view, or nullptr if the whole workspace needs to
+     *   be composited.
+     */
+    wayfire_view find_fullscreen_view()
+    {
+        if (renderer || output_inhibit_counter || runtime_config.damage_debug ||
+            postprocessing->has_post_effects() ||
+            effects->effects[OUTPUT_EFFECT_OVERLAY].size())
+        {
+            return nullptr;
+        }
+
+        /* Plugins with an active grab usually draw something themselves */
+        if (static_cast<wf::output_impl_t*>(output)->get_input_grab_interface())
+        {
+            return nullptr;
+        }
+
+        auto& drag_icon = wf::get_core_impl().input->drag_icon;
+        if (drag_icon && drag_icon->is_mapped())
+        {
+            return nullptr;
+        }
+
+        auto cws = output->workspace->get_current_workspace();
+        for (auto& entry : get_retained_views(cws).views)
+        {
+            auto& view = entry.view;
+            bool visible = needs_visibility_recheck(view) ?
+                output->workspace->view_visible_on(view, cws) : entry.visible;
+            if (!visible || !view->is_visible())
+            {
+                continue;
+            }
+
+            /* The topmost visible view decides */
+            if (!view->fullscreen)
+            {
+                return nullptr;
+            }
+
+            for (auto& child : view->enumerate_views(false))
+            {
+                if (child->has_transformer() || !child->is_mapped())
+                {
+                    return nullptr;
+                }
+            }
+
+            wf::region_t uncovered{output->get_relative_geometry()};
+            uncovered ^= view->get_transformed_opaque_region();
+
+            return uncovered.empty() ? view : nullptr;
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Render only the surfaces of the given fullscreen view, directly to the
+     * target framebuffer. The workspace stream is not updated, and no empty
+     * areas are cleared, as the view covers the whole output.
+     */
+    void render_fullscreen_view(wayfire_view view)
+    {
+        workspace_stream_repaint_t repaint;
+        repaint.ws_damage = output_damage->get_scheduled_damage();
+        damage_simplifier.simplify(repaint.ws_damage);
+        repaint.fb    = postprocessing->get_target_framebuffer();
+        repaint.ws_dx = repaint.ws_dy = 0;
+        repaint.fb.geometry.x = repaint.fb.geometry.y = 0;
+
+        repaint.to_render_begin = damaged_surfaces.used;
+        for (auto& child : view->enumerate_views(false))
+        {
+            auto obox = child->get_output_geometry();
+            for (auto& surface : child->enumerate_surfaces({obox.x, obox.y}))
+            {
+                schedule_surface(repaint, surface.surface, surface.position);
+            }
+        }
+
+        repaint.to_render_end = damaged_surfaces.used;
+        render_views(repaint);
+        damaged_surfaces.release_to(repaint.to_render_begin);
     }
 
     /**
-     * The default renderer, which just makes sure the correct workspace stream
-     * is drawn to the framebuffer
+     * Get the surface of the fullscreen view if its buffer can be presented
+     * directly, without rendering anything. This works only if the view
+     * consists of a single surface whose buffer covers the output exactly,
+     * with the output's scale and transform, and no software cursor is
+     * visible.
      */
-    void default_renderer()
+    wlr_surface *get_scanout_surface(wayfire_view view)
     {
-        if (runtime_config.damage_debug)
+        if (!direct_scanout_opt)
         {
-            /* Clear the screen to yellow, so that the repainted parts are
-             * visible */
-            swap_damage |= output_damage->get_wlr_damage_box();
+            return nullptr;
+        }
 
-            OpenGL::render_begin(output->handle->width, output->handle->height,
-                postprocessing->output_fb);
-            OpenGL::clear({1, 1, 0, 1});
-            OpenGL::render_end();
+        auto surface = view->get_wlr_surface();
+        if (!surface || !surface->buffer ||
+            (view->enumerate_views(false).size() != 1) ||
+            (view->enumerate_surfaces({0, 0}).size() != 1))
+        {
+            return nullptr;
         }
 
-        auto cws = output->workspace->get_current_workspace();
-        auto target_stream = &default_streams[cws.x][cws.y];
-        if (current_ws_stream.get() != target_stream)
+        /* The buffer is presented as-is, so it must not be cropped or scaled */
+        auto handle = output->handle;
+        auto& state = surface->current;
+        if (((float)state.scale != handle->scale) ||
+            (state.transform != handle->transform) ||
+            state.viewport.has_src || state.viewport.has_dst ||
+            (state.buffer_width != handle->width) ||
+            (state.buffer_height != handle->height) ||
+            (view->get_output_geometry() != output->get_relative_geometry()))
         {
-            if (current_ws_stream)
-            {
-                workspace_stream_stop(*current_ws_stream);
-            }
+            return nullptr;
+        }
 
-            current_ws_stream = nonstd::make_observer(target_stream);
-            workspace_stream_start(*current_ws_stream);
-        } else
+        wlr_output_cursor *cursor;
+        wl_list_for_each(cursor, &handle->cursors, link)
         {
-            workspace_stream_update(*current_ws_stream);
+            if (cursor->enabled && cursor->visible &&
+                (cursor != handle->hardware_cursor))
+            {
+                return nullptr;
+            }
         }
+
+        return surface;
     }
 
+    /* The buffer presented by the last successful scanout */
+    wlr_buffer *scanout_buffer = nullptr;
+
     /**
-     * Return the swap damage if called from overlay or postprocessing
-     * effect callbacks or empty region otherwise.
+     * Whether the output shows an old frame of the surface: either the last
+     * frame was not scanned out, or the surface committed a new buffer or
+     * something else damaged the output since then.
      */
-    wf::region_t get_swap_damage()
+    bool needs_scan_out(wlr_surface *surface)
     {
-        return swap_damage;
+        return (last_frame_path != FRAME_PATH_SCANOUT) ||
+               (&surface->buffer->base != scanout_buffer) ||
+               !output_damage->frame_damage.empty();
     }
 
     /**
-     * Render an output. Either calls the built-in renderer, or the render hook
-     * of a plugin
+     * Commit the buffer of the given surface directly to the output.
+     *
+     * @return true if the buffer was committed to the output.
      */
-    void render_output()
+    bool scan_out(wayfire_view view, wlr_surface *surface)
     {
-        if (renderer)
-        {
-            renderer(postprocessing->get_target_framebuffer());
-            /* TODO: let custom renderers specify what they want to repaint... */
-            swap_damage |= output_damage->get_wlr_damage_box();
-        } else
+        auto handle = output->handle;
+        if (!wlr_output_attach_buffer(handle, &surface->buffer->base) ||
+            !wlr_output_commit(handle))
         {
-            swap_damage =
-                output_damage->get_scheduled_damage() * output->handle->scale;
-            swap_damage &= output_damage->get_wlr_damage_box();
-            default_renderer();
+            wlr_output_rollback(handle);
+
+            return false;
         }
+
+        scanout_buffer = &surface->buffer->base;
+        send_sampled_on_output(view.get());
+        /* Everything scheduled for repaint has been replaced by the buffer */
+        output_damage->frame_damage.clear();
+
+        return true;
     }
 
     void update_bound_output()
@@ -723,6 +2093,23 @@ class wf::render_manager::impl
         }
     }
 
+    /* Whether the last call to paint() repainted a frame */
+    bool frame_repainted = false;
+
+    /** Repaint the output, and record the duration for the render delay */
+    void timed_paint()
+    {
+        auto start = std::chrono::steady_clock::now();
+        frame_repainted = false;
+        paint();
+        if (frame_repainted)
+        {
+            render_delay.frame_repainted(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
     /**
      * Repaints the whole output, includes all effects and hooks
      */
@@ -734,11 +2121,51 @@ class wf::render_manager::impl
             wlr_backend_get_presentation_clock(wf::get_core_impl().backend);
         clock_gettime(presentation_clock, &repaint_started);
 
+        frame_timing.start_frame(repaint_started);
+        stream_buffers.next_frame();
+        frame_timing.start_phase();
         effects->run_effects(OUTPUT_EFFECT_PRE);
+        frame_timing.end_phase(FRAME_PHASE_PRE);
+
+        auto fullscreen_view = find_fullscreen_view();
+        auto scanout_surface = fullscreen_view ?
+            get_scanout_surface(fullscreen_view) : nullptr;
+        if (scanout_surface && !needs_scan_out(scanout_surface))
+        {
+            /* The current buffer of the view is already on the output */
+            frame_timing.cancel_frame();
+            post_paint();
+            wlr_output_rollback(output->handle);
+
+            return;
+        }
+
+        if (scanout_surface)
+        {
+            frame_timing.start_phase();
+            if (scan_out(fullscreen_view, scanout_surface))
+            {
+                frame_timing.end_phase(FRAME_PHASE_SWAP);
+                frame_timing.start_phase();
+                post_paint();
+                frame_timing.end_phase(FRAME_PHASE_POST);
+                end_frame(FRAME_PATH_SCANOUT);
+
+                return;
+            }
+        }
+
+        if (last_frame_path == FRAME_PATH_SCANOUT)
+        {
+            /* The contents of the output buffers are stale, as the damage
+             * during scanout was not tracked for them */
+            output_damage->damage_whole();
+        }
 
         bool needs_swap;
         if (!output_damage->make_current(needs_swap))
         {
+            frame_timing.cancel_frame();
             wlr_output_rollback(output->handle);
 
             return;
@@ -749,6 +2176,7 @@ class wf::render_manager::impl
             /* Optimization: the output doesn't need a swap (so isn't damaged),
              * and no plugin wants custom redrawing - we can just skip the whole
              * repaint */
+            frame_timing.cancel_frame();
             post_paint();
             wlr_output_rollback(output->handle);
 
@@ -759,22 +2187,30 @@ class wf::render_manager::impl
 
         /* Part 2: call the renderer, which sets swap_damage and
          * draws the scenegraph */
-        render_output();
+        frame_timing.start_phase();
+        render_output(fullscreen_view);
+        frame_timing.end_phase(FRAME_PHASE_RENDER);
 
         /* Part 3: finalize the scene: overlay effects and sw cursors */
+        frame_timing.start_phase();
         effects->run_effects(OUTPUT_EFFECT_OVERLAY);
+        frame_timing.end_phase(FRAME_PHASE_OVERLAY);
 
-        if (postprocessing->post_effects.size())
+        if (postprocessing->has_post_effects())
         {
             swap_damage |= output_damage->get_wlr_damage_box();
         }
 
+        frame_timing.start_phase();
         OpenGL::render_begin(postprocessing->get_target_framebuffer());
         wlr_output_render_software_cursors(output->handle, swap_damage.to_pixman());
         OpenGL::render_end();
+        frame_timing.end_phase(FRAME_PHASE_SW_CURSORS);
 
         /* Part 4: postprocessing effects */
+        frame_timing.start_phase();
         postprocessing->run_post_effects();
+        frame_timing.end_phase(FRAME_PHASE_POST_EFFECTS);
         if (output_inhibit_counter)
         {
             OpenGL::render_begin(output->handle->width, output->handle->height,
@@ -784,10 +2220,76 @@ class wf::render_manager::impl
         }
 
         /* Part 5: finalize frame: swap buffers, send frame_done, etc */
+        frame_timing.start_phase();
         OpenGL::unbind_output(output);
         output_damage->swap_buffers(swap_damage);
         swap_damage.clear();
+        frame_timing.end_phase(FRAME_PHASE_SWAP);
+
+        frame_timing.start_phase();
         post_paint();
+        frame_timing.end_phase(FRAME_PHASE_POST);
+
+        end_frame(fullscreen_view ? FRAME_PATH_FULLSCREEN : FRAME_PATH_COMPOSITED);
+    }
+
+    /** Count a repainted frame and finish recording its timing */
+    void end_frame(frame_path_t path)
+    {
+        frame_repainted = true;
+        ++frame_counts[path];
+        if (path != last_frame_path)
+        {
+            LOGD("Output ", output->handle->name, ": ",
+                frame_path_names[last_frame_path], " -> ",
+                frame_path_names[path], " frames");
+            last_frame_path = path;
+        }
+
+        frame_timing.current.path = path;
+        if (auto timing = frame_timing.end_frame())
+        {
+            frame_timing_signal data;
+            data.output = output;
+            data.timing = timing;
+            output->render->emit_signal("frame-timing", &data);
+        }
+    }
+
+    void dump_frame_timings(std::ostream& out)
+    {
+        static const char *phase_names[] = {
+            "pre", "render", "overlay", "sw_cursors", "post_effects", "swap",
+            "post",
+        };
+
+        out << "# output " << output->handle->name << ": " <<
+            frame_timing.history.size() << " frames, durations in us\n";
+        out << "# frames since start:";
+        for (int i = 0; i < FRAME_PATH_TOTAL; i++)
+        {
+            out << " " << frame_path_names[i] << "=" << frame_counts[i];
+        }
+
+        out << "\n";
+        for (auto& frame : frame_timing.history)
+        {
+            out << "frame " << frame.start.tv_sec << "." <<
+                std::setfill('0') << std::setw(9) << frame.start.tv_nsec <<
+                std::setfill(' ') << " path=" << frame_path_names[frame.path] <<
+                " total=" << frame.total;
+            for (int i = 0; i < FRAME_PHASE_TOTAL; i++)
+            {
+                out << " " << phase_names[i] << "=" << frame.phases[i];
+            }
+
+            out << "\n";
+            for (auto& hook : frame.hooks)
+            {
+                out << "  hook " << phase_names[hook.phase] << " " <<
+                    hook.duration << " " << hook.name << "\n";
+            }
+        }
     }
 
     /**
@@ -805,37 +2307,95 @@ class wf::render_manager::impl
         send_frame_done();
     }
 
+    /** Wakes up the output so that throttled surfaces get their callbacks */
+    wf::wl_timer occluded_frame_timer;
+
+    /** @return The interval between frame callbacks of occluded surfaces in ms */
+    uint32_t get_occluded_frame_interval() const
+    {
+        /* At most 1000 callbacks per second, so the interval is never 0 */
+        return 1000 / wf::clamp((int)occluded_frame_rate_opt, 1, 1000);
+    }
+
     /**
-     * Send frame_done to clients.
+     * Send frame_done to the surface, unless it is occluded and has already
+     * received a frame callback less than 1 / occluded_frame_rate seconds ago.
+     *
+     * @return true if the frame callback was held back.
      */
-    void send_frame_done()
+    bool send_surface_frame_done(wf::surface_interface_t *surface,
+        bool occluded, const timespec& frame_end)
     {
-        /* TODO: do this only if the view isn't fully occluded by another */
-        std::vector<wayfire_view> visible_views;
-        if (renderer)
-        {
-            visible_views = output->workspace->get_views_in_layer(
-                wf::VISIBLE_LAYERS);
-        } else
+        auto now = wf::get_current_time();
+        if (occluded)
         {
-            visible_views = output->workspace->get_views_on_workspace(
-                output->workspace->get_current_workspace(),
-                wf::MIDDLE_LAYERS);
-
-            // send to all panels/backgrounds/etc
-            auto additional_views = output->workspace->get_views_in_layer(
-                wf::BELOW_LAYERS | wf::ABOVE_LAYERS);
+            if (occluded_frame_rate_opt <= 0)
+            {
+                return true;
+            }
 
-            visible_views.insert(visible_views.end(),
-                additional_views.begin(), additional_views.end());
+            if (now - surface->priv->last_frame_done <
+                get_occluded_frame_interval())
+            {
+                return true;
+            }
         }
 
+        surface->priv->last_frame_done = now;
+        surface->send_frame_done(frame_end);
+
+        return false;
+    }
+
+    /**
+     * Check whether the given box is fully hidden by the already accumulated
+     * opaque region, or lies completely outside of the output.
+     */
+    bool is_occluded(const wf::region_t& covered, wlr_box box)
+    {
+        wf::region_t visible{box};
+        visible &= output->get_relative_geometry();
+
+        return (visible ^ covered).empty();
+    }
+
+    /**
+     * Send frame_done to clients.
+     */
+    void send_frame_done()
+    {
         timespec repaint_ended;
         clockid_t presentation_clock =
             wlr_backend_get_presentation_clock(wf::get_core_impl().backend);
         clock_gettime(presentation_clock, &repaint_ended);
-        for (auto& v : visible_views)
+
+        /* With a custom renderer we don't know what is visible on the screen,
+         * so every surface gets a callback, just like when occlusion detection
+         * is disabled. */
+        bool check_occlusion = !renderer && (occluded_frame_rate_opt >= 0);
+
+        /* The opaque region of all surfaces processed so far. Since we go
+         * from the topmost to the bottommost surface, a surface which is
+         * contained in it is fully hidden. */
+        wf::region_t covered;
+        bool throttled = false;
+        auto cws = output->workspace->get_current_workspace();
+        for (auto& v :
+             output->workspace->get_views_in_layer_snapshot(wf::VISIBLE_LAYERS))
         {
+            /* Without a custom renderer, views in the middle layers need to be
+             * on the current workspace, panels/backgrounds/etc. always get
+             * frame callbacks.
+             *
+             * We keep the stacking order, as it is needed to find out which
+             * surfaces are covered by the surfaces above them. */
+            if (!renderer &&
+                (output->workspace->get_view_layer(v) & wf::MIDDLE_LAYERS) &&
+                !output->workspace->view_visible_on(v, cws))
+            {
+                continue;
+            }
+
             for (auto& view : v->enumerate_views())
             {
                 if (!view->is_mapped())
@@ -843,24 +2403,75 @@ class wf::render_manager::impl
                     continue;
                 }
 
-                for (auto& child : view->enumerate_surfaces())
+                if (!check_occlusion || !view->is_visible())
+                {
+                    for (auto& child : view->enumerate_surfaces())
+                    {
+                        send_surface_frame_done(child.surface, false,
+                            repaint_ended);
+                    }
+
+                    continue;
+                }
+
+                if (view->has_transformer())
+                {
+                    /* Transformed views are handled as a whole */
+                    bool occluded =
+                        is_occluded(covered, view->get_bounding_box());
+                    for (auto& child : view->enumerate_surfaces())
+                    {
+                        throttled |= send_surface_frame_done(child.surface,
+                            occluded, repaint_ended);
+                    }
+
+                    covered |= view->get_transformed_opaque_region();
+                    continue;
+                }
+
+                auto obox = view->get_output_geometry();
+                for (auto& child : view->enumerate_surfaces({obox.x, obox.y}))
                 {
-                    child.surface->send_frame_done(repaint_ended);
+                    auto size = child.surface->get_size();
+                    wlr_box box = {child.position.x, child.position.y,
+                        size.width, size.height};
+
+                    throttled |= send_surface_frame_done(child.surface,
+                        is_occluded(covered, box), repaint_ended);
+                    covered |= child.surface->get_opaque_region(child.position);
                 }
             }
         }
+
+        /* Occluded clients wait for their next frame callback before drawing
+         * again, so nothing will damage the output on their behalf. Make sure
+         * we come back to send the throttled callbacks. */
+        if (throttled && (occluded_frame_rate_opt > 0))
+        {
+            occluded_frame_timer.set_timeout(get_occluded_frame_interval(),
+                [=] ()
+            {
+                wlr_output_schedule_frame(output->handle);
+            });
+        }
     }
 
     /* Workspace stream implementation */
+    /* Emitted for every stream on every frame, so interned once */
+    const wf::signal_id_t workspace_stream_pre =
+        wf::get_signal_id("workspace-stream-pre");
+    const wf::signal_id_t workspace_stream_post =
+        wf::get_signal_id("workspace-stream-post");
+
     void workspace_stream_start(workspace_stream_t& stream)
     {
         stream.running = true;
-        stream.scale_x = stream.scale_y = 1;
 
         /* damage the whole workspace region, so that we get a full repaint
-         * when updating the workspace */
+         * when updating the workspace. The stream keeps its scale, so that
+         * plugins can set it up before starting the stream. */
         output_damage->damage(output_damage->get_ws_box(stream.ws));
-        workspace_stream_update(stream, 1, 1);
+        workspace_stream_update(stream, stream.scale_x, stream.scale_y);
     }
 
     /**
@@ -878,7 +2489,49 @@ class wf::render_manager::impl
         wf::region_t damage;
     };
 
-    using damaged_surface = std::unique_ptr<damaged_surface_t>;
+    /**
+     * A pool of damaged_surface_t which are reused between frames, so that
+     * neither the entries nor their damage regions are reallocated each frame.
+     *
+     * Entries are handed out like a stack: each repaint owns the contiguous
+     * range it has acquired and releases it after rendering, so nested
+     * workspace stream updates are safe.
+     */
+    struct damaged_surface_pool_t
+    {
+        /* A deque, so that entries do not move when the pool grows */
+        std::deque<damaged_surface_t> storage;
+        size_t used = 0;
+
+        damaged_surface_t *acquire()
+        {
+            if (used == storage.size())
+            {
+                storage.emplace_back();
+            }
+
+            auto& ds = storage[used++];
+            ds.surface = nullptr;
+            ds.view    = nullptr;
+            ds.pos     = {0, 0};
+
+            return &ds;
+        }
+
+        /** Release the most recently acquired entry */
+        void release_last()
+        {
+            --used;
+        }
+
+        /** Release all entries acquired after the given mark */
+        void release_to(size_t mark)
+        {
+            used = mark;
+        }
+    };
+
+    damaged_surface_pool_t damaged_surfaces;
 
     /**
      * Represents the state while calculating what parts of the output
@@ -886,7 +2539,11 @@ class wf::render_manager::impl
      */
     struct workspace_stream_repaint_t
     {
-        std::vector<damaged_surface> to_render;
+        /* The surfaces to render are damaged_surfaces.storage[begin, end),
+         * from the topmost to the bottommost */
+        size_t to_render_begin = 0;
+        size_t to_render_end   = 0;
+
         wf::region_t ws_damage;
         wf::framebuffer_t fb;
 
@@ -903,17 +2560,21 @@ class wf::render_manager::impl
     void schedule_snapshotted_view(workspace_stream_repaint_t& repaint,
         wayfire_view view, wf::point_t view_delta)
     {
-        auto ds = damaged_surface(new damaged_surface_t);
+        auto ds = damaged_surfaces.acquire();
 
         auto bbox = view->get_bounding_box() + view_delta;
-        ds->damage = (repaint.ws_damage & bbox) + -view_delta;
+        ds->damage  = repaint.ws_damage;
+        ds->damage &= bbox;
+        ds->damage += -view_delta;
         if (!ds->damage.empty())
         {
             ds->pos  = -view_delta;
             ds->view = view.get();
             repaint.ws_damage ^=
                 view->get_transformed_opaque_region() + view_delta;
-            repaint.to_render.push_back(std::move(ds));
+        } else
+        {
+            damaged_surfaces.release_last();
         }
     }
 
@@ -934,7 +2595,7 @@ class wf::render_manager::impl
             return;
         }
 
-        auto ds = damaged_surface(new damaged_surface_t);
+        auto ds = damaged_surfaces.acquire();
         wlr_box obox = {
             .x     = pos.x,
             .y     = pos.y,
@@ -942,7 +2603,8 @@ class wf::render_manager::impl
             .height = surface->get_size().height
         };
 
-        ds->damage = repaint.ws_damage & obox;
+        ds->damage  = repaint.ws_damage;
+        ds->damage &= obox;
         if (!ds->damage.empty())
         {
             ds->pos     = pos;
@@ -951,7 +2613,9 @@ class wf::render_manager::impl
             /* Subtract opaque region from workspace damage. The views below
              * won't be visible, so no need to damage them */
             repaint.ws_damage ^= ds->surface->get_opaque_region(pos);
-            repaint.to_render.push_back(std::move(ds));
+        } else
+        {
+            damaged_surfaces.release_last();
         }
     }
 
@@ -999,12 +2663,20 @@ class wf::render_manager::impl
     void check_schedule_surfaces(workspace_stream_repaint_t& repaint,
         workspace_stream_t& stream)
     {
-        auto views = output->workspace->get_views_on_workspace(stream.ws,
-            wf::VISIBLE_LAYERS);
+        auto& retained = get_retained_views(stream.ws);
 
+        repaint.to_render_begin = damaged_surfaces.used;
         schedule_drag_icon(repaint);
-        for (auto& v : views)
+        for (auto& entry : retained.views)
         {
+            auto& v = entry.view;
+            bool visible = needs_visibility_recheck(v) ?
+                output->workspace->view_visible_on(v, stream.ws) : entry.visible;
+            if (!visible)
+            {
+                continue;
+            }
+
             for (auto& view : v->enumerate_views(false))
             {
                 wf::point_t view_delta{0, 0};
@@ -1042,6 +2714,20 @@ class wf::render_manager::impl
                 }
             }
         }
+
+        repaint.to_render_end = damaged_surfaces.used;
+    }
+
+    /**
+     * Streams are rendered with a uniform scale, because the scale of the
+     * framebuffer is uniform. The larger of the requested scales is used, so
+     * that the stream is never rendered at a lower resolution than requested.
+     */
+    static float get_stream_scale(float scale_x, float scale_y)
+    {
+        float scale = std::max(scale_x, scale_y);
+
+        return (scale > 0 && scale < 1) ? scale : 1;
     }
 
     /**
@@ -1051,33 +2737,49 @@ class wf::render_manager::impl
         workspace_stream_t& stream, float scale_x, float scale_y)
     {
         workspace_stream_repaint_t repaint;
-        repaint.ws_damage = output_damage->get_ws_damage(stream.ws);
 
-        /* we don't have to update anything */
-        if (repaint.ws_damage.empty())
+        /* The default streams are rendered directly to the output */
+        bool is_default = (stream.buffer.tex == 0);
+        if (!is_default)
         {
-            return repaint;
+            stream.scale_x = scale_x;
+            stream.scale_y = scale_y;
         }
 
-        if ((scale_x != stream.scale_x) || (scale_y != stream.scale_y))
+        float scale = is_default ? 1 : get_stream_scale(scale_x, scale_y);
+        int width  = std::ceil(output->handle->width * scale);
+        int height = std::ceil(output->handle->height * scale);
+
+        if (is_default)
         {
-            /* FIXME: enable scaled rendering */
-            // stream->scale_x = scale_x;
-            // stream->scale_y = scale_y;
+            OpenGL::render_begin();
+            stream.buffer.allocate(width, height);
+            OpenGL::render_end();
+        } else if (stream_buffers.allocate(stream, width, height))
+        {
+            /* New buffer or a different scale, repaint everything */
+            output_damage->damage(output_damage->get_ws_box(stream.ws));
+        }
 
-            // ws_damage |= get_damage_box();
+        repaint.ws_damage = output_damage->get_ws_damage(stream.ws);
+
+        /* we don't have to update anything */
+        if (repaint.ws_damage.empty())
+        {
+            return repaint;
         }
 
-        OpenGL::render_begin();
-        stream.buffer.allocate(output->handle->width, output->handle->height);
-        OpenGL::render_end();
+        damage_simplifier.simplify(repaint.ws_damage);
 
         repaint.fb = postprocessing->get_target_framebuffer();
-        if ((stream.buffer.tex != 0))
+        if (!is_default)
         {
             /* Use the workspace buffers */
             repaint.fb.fb  = stream.buffer.fb;
             repaint.fb.tex = stream.buffer.tex;
+            repaint.fb.scale *= scale;
+            repaint.fb.viewport_width  = width;
+            repaint.fb.viewport_height = height;
         }
 
         auto g   = output->get_relative_geometry();
@@ -1088,6 +2790,15 @@ class wf::render_manager::impl
         repaint.fb.geometry.x = repaint.ws_dx;
         repaint.fb.geometry.y = repaint.ws_dy;
 
+        if (scale < 1)
+        {
+            /* The buffer size is rounded up, so a pixel of the buffer may cover
+             * a bit more than its share of the damage. Repaint the whole pixels
+             * around the damage, otherwise stale columns remain at its edges. */
+            repaint.ws_damage.expand_edges(std::ceil(1.0 / repaint.fb.scale));
+            repaint.ws_damage &= output_damage->get_ws_box(stream.ws);
+        }
+
         return repaint;
     }
 
@@ -1117,8 +2828,9 @@ class wf::render_manager::impl
     {
         wf::geometry_t fb_geometry = repaint.fb.geometry;
 
-        for (auto& ds : wf::reverse(repaint.to_render))
+        for (size_t i = repaint.to_render_end; i > repaint.to_render_begin; i--)
         {
+            auto ds = &damaged_surfaces.storage[i - 1];
             if (ds->view)
             {
                 repaint.fb.geometry = fb_geometry + ds->pos;
@@ -1153,7 +2865,7 @@ class wf::render_manager::impl
 
         {
             stream_signal_t data(stream.ws, repaint.ws_damage, repaint.fb);
-            output->render->emit_signal("workspace-stream-pre", &data);
+            output->render->emit_signal(workspace_stream_pre, &data);
         }
 
         check_schedule_surfaces(repaint, stream);
@@ -1167,17 +2879,49 @@ class wf::render_manager::impl
         }
 
         render_views(repaint);
+        damaged_surfaces.release_to(repaint.to_render_begin);
 
         unschedule_drag_icon();
         {
             stream_signal_t data(stream.ws, repaint.ws_damage, repaint.fb);
-            output->render->emit_signal("workspace-stream-post", &data);
+            output->render->emit_signal(workspace_stream_post, &data);
+        }
+
+        if (stream.buffer.tex != 0)
+        {
+            update_stream_mipmaps(stream);
+        }
+    }
+
+    /**
+     * Scaled streams are usually minified even further when they are shown,
+     * so they get mipmaps, which are regenerated whenever the stream changes.
+     * Full-size streams don't pay for them.
+     */
+    void update_stream_mipmaps(workspace_stream_t& stream)
+    {
+        bool scaled = get_stream_scale(stream.scale_x, stream.scale_y) < 1;
+
+        OpenGL::render_begin();
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, stream.buffer.tex));
+        if (scaled)
+        {
+            GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
         }
+
+        GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+            scaled ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        OpenGL::render_end();
     }
 
     void workspace_stream_stop(workspace_stream_t& stream)
     {
         stream.running = false;
+        if (stream.buffer.tex != 0)
+        {
+            stream_buffers.stop(stream);
+        }
     }
 };
 
@@ -1230,6 +2974,16 @@ void render_manager::rem_post(post_hook_t *hook)
     pimpl->postprocessing->rem_post(hook);
 }
 
+void render_manager::add_post_effect(post_effect_t *effect)
+{
+    pimpl->postprocessing->add_post_effect(effect);
+}
+
+void render_manager::rem_post_effect(post_effect_t *effect)
+{
+    pimpl->postprocessing->rem_post_effect(effect);
+}
+
 wf::region_t render_manager::get_scheduled_damage()
 {
     return pimpl->output_damage->get_scheduled_damage();
@@ -1273,7 +3027,38 @@ void render_manager::workspace_stream_start(workspace_stream_t& stream)
 void render_manager::workspace_stream_update(workspace_stream_t& stream,
     float scale_x, float scale_y)
 {
-    pimpl->workspace_stream_update(stream);
+    pimpl->workspace_stream_update(stream, scale_x, scale_y);
+}
+
+std::vector<frame_timing_t> render_manager::get_frame_timings() const
+{
+    return {pimpl->frame_timing.history.begin(),
+        pimpl->frame_timing.history.end()};
+}
+
+void render_manager::dump_frame_timings(std::ostream& out) const
+{
+    pimpl->dump_frame_timings(out);
+}
+
+uint64_t render_manager::get_frame_count(frame_path_t path) const
+{
+    return pimpl->frame_counts[path];
+}
+
+stream_memory_usage_t render_manager::get_stream_memory_usage() const
+{
+    return pimpl->stream_buffers.get_usage();
+}
+
+render_delay_stats_t render_manager::get_render_delay_stats() const
+{
+    return pimpl->render_delay.get_stats();
+}
+
+damage_stats_t render_manager::get_damage_stats() const
+{
+    return pimpl->damage_simplifier.get_stats();
 }
 
 void render_manager::workspace_stream_stop(workspace_stream_t& stream)
@@ -6,9 +6,12 @@
 #include <wayfire/signal-definitions.hpp>
 #include <wayfire/opengl.hpp>
 #include <list>
+#include <map>
+#include <tuple>
 #include <algorithm>
 #include <wayfire/nonstd/reverse.hpp>
 #include <wayfire/util/log.hpp>
+#include "../view/view-impl.hpp"
 
 namespace wf
 {
@@ -69,6 +72,46 @@ void remove_from(Haystack& haystack, Needle& n)
     haystack.erase(it, std::end(haystack));
 }
 
+/**
+ * A list of views which is cached until it is out of date.
+ */
+struct cached_views_t
+{
+    /* The version of the state the views were generated from */
+    uint64_t version = 0;
+    /* Whether the views have to be regenerated on each query */
+    bool volatile_views = true;
+    std::shared_ptr<std::vector<wayfire_view>> views;
+
+    /**
+     * Get the cached views, or regenerate them if the state they were
+     * generated from has changed since then.
+     *
+     * @param current_version The version of the current state. It must change
+     *   whenever the state which the views depend on changes.
+     * @param fill The function which generates the views. It returns false if
+     *   the views depend on state which is not covered by the version.
+     */
+    template<class Fill>
+    view_snapshot_t get(uint64_t current_version, Fill fill)
+    {
+        if (volatile_views || (version != current_version))
+        {
+            /* Reuse the list if nobody holds a snapshot of it */
+            if (!views || (views.use_count() > 1))
+            {
+                views = std::make_shared<std::vector<wayfire_view>>();
+            }
+
+            views->clear();
+            volatile_views = !fill(*views);
+            version = current_version;
+        }
+
+        return view_snapshot_t{views};
+    }
+};
+
 struct layer_container_t;
 /**
  * Implementation of the sublayer struct.
@@ -133,7 +176,17 @@ class output_layer_manager_t
 {
     layer_container_t layers[TOTAL_LAYERS];
 
+    /* The lists of views, cached by layer mask */
+    std::map<uint32_t, cached_views_t> layer_cache;
+    cached_views_t promoted_cache;
+
   public:
+    /**
+     * Incremented whenever a view is added, removed, restacked or promoted, so
+     * that cached lists of views can be invalidated.
+     */
+    uint64_t stacking_version = 0;
+
     output_layer_manager_t()
     {
         for (int i = 0; i < TOTAL_LAYERS; i++)
@@ -181,6 +234,7 @@ class output_layer_manager_t
         }
 
         view->damage();
+        ++stacking_version;
 
         remove_from(sublayer->views, view);
         if (sublayer->is_single_view)
@@ -198,6 +252,7 @@ class output_layer_manager_t
         remove_view(view);
         get_view_sublayer(view) = sublayer;
         sublayer->views.push_front(view);
+        ++stacking_version;
     }
 
     nonstd::observer_ptr<sublayer_t> create_sublayer(layer_t layer_mask,
@@ -241,6 +296,7 @@ class output_layer_manager_t
     void bring_to_front(wayfire_view view)
     {
         view->damage();
+        ++stacking_version;
 
         auto sublayer = get_view_sublayer(view);
         assert(sublayer);
@@ -267,6 +323,7 @@ class output_layer_manager_t
     void restack_above(wayfire_view view, wayfire_view below)
     {
         view->damage();
+        ++stacking_version;
 
         auto view_sublayer  = get_view_sublayer(view);
         auto below_sublayer = get_view_sublayer(below);
@@ -293,6 +350,7 @@ class output_layer_manager_t
     void restack_below(wayfire_view view, wayfire_view above)
     {
         view->damage();
+        ++stacking_version;
 
         auto view_sublayer  = get_view_sublayer(view);
         auto above_sublayer = get_view_sublayer(above);
@@ -337,44 +395,50 @@ class output_layer_manager_t
         }
     }
 
-    std::vector<wayfire_view> get_views_in_layer(uint32_t layers_mask)
+    view_snapshot_t get_views_in_layer(uint32_t layers_mask)
     {
-        std::vector<wayfire_view> views;
-        auto try_push = [&] (layer_t layer, bool promoted = false)
+        return layer_cache[layers_mask].get(stacking_version,
+            [&] (std::vector<wayfire_view>& views)
         {
-            if (!(layer & layers_mask))
+            auto try_push = [&] (layer_t layer, bool promoted = false)
             {
-                return;
-            }
+                if (!(layer & layers_mask))
+                {
+                    return;
+                }
 
-            push_views(views, layer, promoted);
-        };
+                push_views(views, layer, promoted);
+            };
 
-        /* Above fullscreen views */
-        for (auto layer : {LAYER_DESKTOP_WIDGET, LAYER_LOCK, LAYER_UNMANAGED})
-        {
-            try_push(layer);
-        }
+            /* Above fullscreen views */
+            for (auto layer : {LAYER_DESKTOP_WIDGET, LAYER_LOCK, LAYER_UNMANAGED})
+            {
+                try_push(layer);
+            }
 
-        /* Fullscreen */
-        try_push(LAYER_WORKSPACE, true);
+            /* Fullscreen */
+            try_push(LAYER_WORKSPACE, true);
 
-        /* Below fullscreen */
-        for (auto layer :
-             {LAYER_TOP, LAYER_WORKSPACE, LAYER_BOTTOM, LAYER_BACKGROUND})
-        {
-            try_push(layer);
-        }
+            /* Below fullscreen */
+            for (auto layer :
+                 {LAYER_TOP, LAYER_WORKSPACE, LAYER_BOTTOM, LAYER_BACKGROUND})
+            {
+                try_push(layer);
+            }
 
-        return views;
+            return true;
+        });
     }
 
-    std::vector<wayfire_view> get_promoted_views()
+    view_snapshot_t get_promoted_views()
     {
-        std::vector<wayfire_view> views;
-        push_views(views, LAYER_WORKSPACE, true);
+        return promoted_cache.get(stacking_version,
+            [&] (std::vector<wayfire_view>& views)
+        {
+            push_views(views, LAYER_WORKSPACE, true);
 
-        return views;
+            return true;
+        });
     }
 
     /**
@@ -398,6 +462,7 @@ class output_layer_manager_t
         }
 
         sublayer->layer->remove_sublayer(sublayer);
+        ++stacking_version;
     }
 };
 
@@ -430,11 +495,69 @@ class output_viewport_manager_t
     int current_vy;
 
     output_t *output;
+    output_layer_manager_t& layer_manager;
+
+    /* The lists of views on each workspace, cached by workspace, layer mask
+     * and whether only promoted views are listed */
+    std::map<std::tuple<int, int, uint32_t, bool>, cached_views_t> workspace_cache;
+
+    /**
+     * Incremented whenever the visibility of the views on the workspaces might
+     * have changed, i.e when the views or the current workspace move.
+     */
+    uint64_t visibility_version = 0;
+    wf::signal_connection_t on_visibility_changed = {[=] (signal_data_t*)
+        {
+            ++visibility_version;
+        }
+    };
+
+    /**
+     * Get the views from the given list which are visible on the workspace.
+     * The result is cached until the list or the views' visibility changes.
+     */
+    view_snapshot_t filter_visible_views(const view_snapshot_t& views,
+        wf::point_t vp, uint32_t layers_mask, bool promoted)
+    {
+        /* All counters only ever increase, so their sum changes whenever one
+         * of them changes */
+        uint64_t version = layer_manager.stacking_version + visibility_version +
+            get_transformers_generation();
+
+        auto& cache = workspace_cache[{vp.x, vp.y, layers_mask, promoted}];
+
+        return cache.get(version, [&] (std::vector<wayfire_view>& visible)
+        {
+            bool cacheable = true;
+            for (auto& view : views)
+            {
+                /* The transformers of a view can change at any time, without
+                 * any notification. Views which are not backed by a wlr_surface
+                 * (compositor views of plugins) may move without reporting it
+                 * on the output. */
+                cacheable &= !view->has_transformer() && view->get_wlr_surface();
+                if (view_visible_on(view, vp))
+                {
+                    visible.push_back(view);
+                }
+            }
+
+            return cacheable;
+        });
+    }
 
   public:
-    output_viewport_manager_t(output_t *output)
+    output_viewport_manager_t(output_t *output,
+        output_layer_manager_t& layer_manager) :
+        layer_manager(layer_manager)
     {
         this->output = output;
+        for (auto signal : {"view-geometry-changed", "view-mapped",
+                            "output-configuration-changed"})
+        {
+            output->connect_signal(signal, &on_visibility_changed);
+        }
+
         vwidth  = wf::option_wrapper_t<int>("core/vwidth");
         vheight = wf::option_wrapper_t<int>("core/vheight");
 
@@ -544,38 +667,17 @@ class output_viewport_manager_t
         }
     }
 
-    std::vector<wayfire_view> get_views_on_workspace(wf::point_t vp,
+    view_snapshot_t get_views_on_workspace(wf::point_t vp,
         uint32_t layers_mask)
     {
-        /* get all views in the given layers */
-        std::vector<wayfire_view> views =
-            output->workspace->get_views_in_layer(layers_mask);
-
-        /* remove those which aren't visible on the workspace */
-        auto it = std::remove_if(views.begin(), views.end(), [&] (wayfire_view view)
-        {
-            return !view_visible_on(view, vp);
-        });
-
-        views.erase(it, views.end());
-
-        return views;
+        return filter_visible_views(layer_manager.get_views_in_layer(layers_mask),
+            vp, layers_mask, false);
     }
 
-    std::vector<wayfire_view> get_promoted_views(wf::point_t workspace)
+    view_snapshot_t get_promoted_views(wf::point_t workspace)
     {
-        std::vector<wayfire_view> views =
-            output->workspace->get_promoted_views();
-
-        /* remove those which aren't visible on the workspace */
-        auto it = std::remove_if(views.begin(), views.end(), [&] (wayfire_view view)
-        {
-            return !view_visible_on(view, workspace);
-        });
-
-        views.erase(it, views.end());
-
-        return views;
+        return filter_visible_views(layer_manager.get_promoted_views(),
+            workspace, 0, true);
     }
 
     std::vector<wayfire_view> get_views_on_workspace_sublayer(wf::point_t vp,
@@ -634,12 +736,13 @@ class output_viewport_manager_t
          * views. */
         current_vx = nws.x;
         current_vy = nws.y;
+        ++visibility_version;
 
         auto screen = output->get_screen_size();
         auto dx     = (data.old_viewport.x - nws.x) * screen.width;
         auto dy     = (data.old_viewport.y - nws.y) * screen.height;
 
-        for (auto& v : output->workspace->get_views_in_layer(MIDDLE_LAYERS))
+        for (auto& v : layer_manager.get_views_in_layer(MIDDLE_LAYERS))
         {
             v->move(v->get_wm_geometry().x + dx,
                 v->get_wm_geometry().y + dy);
@@ -838,7 +941,7 @@ class workspace_manager::impl
 
     impl(output_t *o) :
         layer_manager(),
-        viewport_manager(o),
+        viewport_manager(o, layer_manager),
         workarea_manager(o)
     {
         output = o;
@@ -933,22 +1036,26 @@ class workspace_manager::impl
             view->get_data_safe<layer_view_data_t>()->is_promoted = false;
         }
 
+        /* The promoted views are listed separately */
+        ++layer_manager.stacking_version;
+
         auto views = viewport_manager.get_views_on_workspace(
             vp, LAYER_WORKSPACE);
 
         /* Do not consider unmapped views or views which are not visible */
-        auto it = std::remove_if(views.begin(), views.end(),
+        auto it = std::find_if(views.begin(), views.end(),
             [] (wayfire_view view) -> bool
         {
-            return !view->is_mapped() || !view->is_visible();
+            return view->is_mapped() && view->is_visible();
         });
-        views.erase(it, views.end());
 
-        if (!views.empty() && views.front()->fullscreen)
+        if ((it != views.end()) && (*it)->fullscreen)
         {
-            views.front()->get_data_safe<layer_view_data_t>()->is_promoted = true;
+            (*it)->get_data_safe<layer_view_data_t>()->is_promoted = true;
         }
 
+        ++layer_manager.stacking_version;
+
         check_autohide_panels();
 
         /**
@@ -1090,6 +1197,13 @@ bool workspace_manager::view_visible_on(wayfire_view view, wf::point_t ws)
 
 std::vector<wayfire_view> workspace_manager::get_views_on_workspace(wf::point_t ws,
     uint32_t layer_mask)
+{
+    return pimpl->viewport_manager.get_views_on_workspace(ws, layer_mask)
+           .to_vector();
+}
+
+view_snapshot_t workspace_manager::get_views_on_workspace_snapshot(
+    wf::point_t ws, uint32_t layer_mask)
 {
     return pimpl->viewport_manager.get_views_on_workspace(ws, layer_mask);
 }
@@ -1153,6 +1267,12 @@ uint32_t workspace_manager::get_view_layer(wayfire_view view)
 }
 
 std::vector<wayfire_view> workspace_manager::get_views_in_layer(uint32_t layers_mask)
+{
+    return pimpl->layer_manager.get_views_in_layer(layers_mask).to_vector();
+}
+
+view_snapshot_t workspace_manager::get_views_in_layer_snapshot(
+    uint32_t layers_mask)
 {
     return pimpl->layer_manager.get_views_in_layer(layers_mask);
 }
@@ -1165,11 +1285,17 @@ std::vector<wayfire_view> workspace_manager::get_views_in_sublayer(
 
 std::vector<wayfire_view> workspace_manager::get_promoted_views()
 {
-    return pimpl->layer_manager.get_promoted_views();
+    return pimpl->layer_manager.get_promoted_views().to_vector();
 }
 
 std::vector<wayfire_view> workspace_manager::get_promoted_views(
     wf::point_t workspace)
+{
+    return pimpl->viewport_manager.get_promoted_views(workspace).to_vector();
+}
+
+view_snapshot_t workspace_manager::get_promoted_views_snapshot(
+    wf::point_t workspace)
 {
     return pimpl->viewport_manager.get_promoted_views(workspace);
 }
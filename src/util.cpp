@@ -5,12 +5,21 @@
 #include <iomanip>
 #include <ctime>
 #include <cmath>
+#include <algorithm>
 
 extern "C"
 {
 #include <wlr/util/region.h>
 }
 
+#ifdef WF_BENCH_HARNESS
+ #include <wayfire/bench-counters.hpp>
+/* The wayfire-bench harness counts the region operations made per frame */
+ #define COUNT_REGION_OP() wf::bench::count_region_op()
+#else
+ #define COUNT_REGION_OP()
+#endif
+
 /* Geometry helpers */
 std::ostream& operator <<(std::ostream& stream, const wf::geometry_t& geometry)
 {
@@ -161,6 +170,61 @@ pixman_box32_t pixman_box_from_wlr_box(const wlr_box& box)
     };
 }
 
+/* Empty regions and regions with a single box are stored without heap
+ * storage by pixman: the box is kept in the extents, and data is NULL for a
+ * single box. Most regions in the render path are like that, e.g surface
+ * damage and opaque regions, so operations on them are done directly on the
+ * extents, without the overhead of the generic pixman operations. */
+static bool is_single_box(const pixman_region32_t& region)
+{
+    return region.data == NULL;
+}
+
+static bool is_empty_box(const pixman_box32_t& box)
+{
+    return (box.x1 >= box.x2) || (box.y1 >= box.y2);
+}
+
+/** @return Whether a contains b */
+static bool box_contains(const pixman_box32_t& a, const pixman_box32_t& b)
+{
+    return (a.x1 <= b.x1) && (a.y1 <= b.y1) && (b.x2 <= a.x2) && (b.y2 <= a.y2);
+}
+
+static bool boxes_overlap(const pixman_box32_t& a, const pixman_box32_t& b)
+{
+    return (a.x1 < b.x2) && (b.x1 < a.x2) && (a.y1 < b.y2) && (b.y1 < a.y2);
+}
+
+static pixman_box32_t intersect_boxes(const pixman_box32_t& a,
+    const pixman_box32_t& b)
+{
+    return {
+        std::max(a.x1, b.x1), std::max(a.y1, b.y1),
+        std::min(a.x2, b.x2), std::min(a.y2, b.y2),
+    };
+}
+
+/** Replace the contents of an initialized region with a single box */
+static void set_box(pixman_region32_t *region, const pixman_box32_t& box)
+{
+    if (is_empty_box(box))
+    {
+        pixman_region32_clear(region);
+
+        return;
+    }
+
+    if (region->data)
+    {
+        /* Free the storage of the previous boxes, if any */
+        pixman_region32_fini(region);
+    }
+
+    region->extents = box;
+    region->data    = NULL;
+}
+
 wf::region_t::region_t()
 {
     pixman_region32_init(&_region);
@@ -171,24 +235,35 @@ wf::region_t::region_t(pixman_region32_t *region) : wf::region_t()
     pixman_region32_copy(this->to_pixman(), region);
 }
 
-wf::region_t::region_t(const wlr_box& box)
+wf::region_t::region_t(const wlr_box& box) : wf::region_t()
 {
-    pixman_region32_init_rect(&_region, box.x, box.y, box.width, box.height);
+    set_box(&_region, pixman_box_from_wlr_box(box));
 }
 
 wf::region_t::~region_t()
 {
-    pixman_region32_fini(&_region);
+    if (_region.data)
+    {
+        pixman_region32_fini(&_region);
+    }
 }
 
-wf::region_t::region_t(const wf::region_t& other) : wf::region_t()
+wf::region_t::region_t(const wf::region_t& other)
 {
-    pixman_region32_copy(this->to_pixman(), other.unconst());
+    if (is_single_box(other._region))
+    {
+        _region = other._region;
+    } else
+    {
+        pixman_region32_init(&_region);
+        pixman_region32_copy(&_region, other.unconst());
+    }
 }
 
-wf::region_t::region_t(wf::region_t&& other) : wf::region_t()
+wf::region_t::region_t(wf::region_t&& other) noexcept
 {
-    std::swap(this->_region, other._region);
+    _region = other._region;
+    pixman_region32_init(&other._region);
 }
 
 wf::region_t& wf::region_t::operator =(const wf::region_t& other)
@@ -198,12 +273,18 @@ wf::region_t& wf::region_t::operator =(const wf::region_t& other)
         return *this;
     }
 
-    pixman_region32_copy(&_region, other.unconst());
+    if (is_single_box(other._region))
+    {
+        set_box(&_region, other._region.extents);
+    } else
+    {
+        pixman_region32_copy(&_region, other.unconst());
+    }
 
     return *this;
 }
 
-wf::region_t& wf::region_t::operator =(wf::region_t&& other)
+wf::region_t& wf::region_t::operator =(wf::region_t&& other) noexcept
 {
     if (&other == this)
     {
@@ -217,7 +298,7 @@ wf::region_t& wf::region_t::operator =(wf::region_t&& other)
 
 bool wf::region_t::empty() const
 {
-    return !pixman_region32_not_empty(this->unconst());
+    return !is_single_box(_region) && !pixman_region32_not_empty(unconst());
 }
 
 void wf::region_t::clear()
@@ -227,6 +308,7 @@ void wf::region_t::clear()
 
 void wf::region_t::expand_edges(int amount)
 {
+    COUNT_REGION_OP();
     /* FIXME: make sure we don't throw pixman errors when amount is bigger
      * than a rectangle size */
     wlr_region_expand(this->to_pixman(), this->to_pixman(), amount);
@@ -234,7 +316,7 @@ void wf::region_t::expand_edges(int amount)
 
 pixman_box32_t wf::region_t::get_extents() const
 {
-    return *pixman_region32_extents(this->unconst());
+    return _region.extents;
 }
 
 bool wf::region_t::contains_point(const wf::point_t& point) const
@@ -263,20 +345,31 @@ bool wf::region_t::contains_pointf(const wf::pointf_t& point) const
 wf::region_t wf::region_t::operator +(const wf::point_t& vector) const
 {
     wf::region_t result{*this};
-    pixman_region32_translate(&result._region, vector.x, vector.y);
+    result += vector;
 
     return result;
 }
 
 wf::region_t& wf::region_t::operator +=(const wf::point_t& vector)
 {
-    pixman_region32_translate(&_region, vector.x, vector.y);
+    COUNT_REGION_OP();
+    if (is_single_box(_region))
+    {
+        _region.extents.x1 += vector.x;
+        _region.extents.x2 += vector.x;
+        _region.extents.y1 += vector.y;
+        _region.extents.y2 += vector.y;
+    } else
+    {
+        pixman_region32_translate(&_region, vector.x, vector.y);
+    }
 
     return *this;
 }
 
 wf::region_t wf::region_t::operator *(float scale) const
 {
+    COUNT_REGION_OP();
     wf::region_t result;
     wlr_region_scale(result.to_pixman(), this->unconst(), scale);
 
@@ -285,6 +378,7 @@ wf::region_t wf::region_t::operator *(float scale) const
 
 wf::region_t& wf::region_t::operator *=(float scale)
 {
+    COUNT_REGION_OP();
     wlr_region_scale(this->to_pixman(), this->to_pixman(), scale);
 
     return *this;
@@ -293,34 +387,68 @@ wf::region_t& wf::region_t::operator *=(float scale)
 /* Region intersection */
 wf::region_t wf::region_t::operator &(const wlr_box& box) const
 {
+    COUNT_REGION_OP();
     wf::region_t result;
-    pixman_region32_intersect_rect(result.to_pixman(), this->unconst(),
-        box.x, box.y, box.width, box.height);
+    if (is_single_box(_region))
+    {
+        set_box(&result._region,
+            intersect_boxes(_region.extents, pixman_box_from_wlr_box(box)));
+    } else if (!empty())
+    {
+        pixman_region32_intersect_rect(result.to_pixman(), this->unconst(),
+            box.x, box.y, box.width, box.height);
+    }
 
     return result;
 }
 
 wf::region_t wf::region_t::operator &(const wf::region_t& other) const
 {
+    COUNT_REGION_OP();
     wf::region_t result;
-    pixman_region32_intersect(result.to_pixman(),
-        this->unconst(), other.unconst());
+    if (is_single_box(_region) && is_single_box(other._region))
+    {
+        set_box(&result._region,
+            intersect_boxes(_region.extents, other._region.extents));
+    } else if (!empty() && !other.empty())
+    {
+        pixman_region32_intersect(result.to_pixman(),
+            this->unconst(), other.unconst());
+    }
 
     return result;
 }
 
 wf::region_t& wf::region_t::operator &=(const wlr_box& box)
 {
-    pixman_region32_intersect_rect(this->to_pixman(), this->to_pixman(),
-        box.x, box.y, box.width, box.height);
+    COUNT_REGION_OP();
+    if (is_single_box(_region))
+    {
+        set_box(&_region,
+            intersect_boxes(_region.extents, pixman_box_from_wlr_box(box)));
+    } else if (!empty())
+    {
+        pixman_region32_intersect_rect(this->to_pixman(), this->to_pixman(),
+            box.x, box.y, box.width, box.height);
+    }
 
     return *this;
 }
 
 wf::region_t& wf::region_t::operator &=(const wf::region_t& other)
 {
-    pixman_region32_intersect(this->to_pixman(),
-        this->to_pixman(), other.unconst());
+    COUNT_REGION_OP();
+    if (is_single_box(_region) && is_single_box(other._region))
+    {
+        set_box(&_region, intersect_boxes(_region.extents, other._region.extents));
+    } else if (other.empty())
+    {
+        clear();
+    } else if (!empty())
+    {
+        pixman_region32_intersect(this->to_pixman(),
+            this->to_pixman(), other.unconst());
+    }
 
     return *this;
 }
@@ -328,15 +456,25 @@ wf::region_t& wf::region_t::operator &=(const wf::region_t& other)
 /* Region union */
 wf::region_t wf::region_t::operator |(const wlr_box& other) const
 {
-    wf::region_t result;
-    pixman_region32_union_rect(result.to_pixman(), this->unconst(),
-        other.x, other.y, other.width, other.height);
+    wf::region_t result{*this};
+    result |= other;
 
     return result;
 }
 
 wf::region_t wf::region_t::operator |(const wf::region_t& other) const
 {
+    COUNT_REGION_OP();
+    if (empty())
+    {
+        return other;
+    }
+
+    if (other.empty())
+    {
+        return *this;
+    }
+
     wf::region_t result;
     pixman_region32_union(result.to_pixman(), this->unconst(), other.unconst());
 
@@ -345,15 +483,36 @@ wf::region_t wf::region_t::operator |(const wf::region_t& other) const
 
 wf::region_t& wf::region_t::operator |=(const wlr_box& other)
 {
-    pixman_region32_union_rect(this->to_pixman(), this->to_pixman(),
-        other.x, other.y, other.width, other.height);
+    COUNT_REGION_OP();
+    auto box = pixman_box_from_wlr_box(other);
+    if (is_empty_box(box))
+    {
+        return *this;
+    }
+
+    if (empty() || box_contains(box, _region.extents))
+    {
+        set_box(&_region, box);
+    } else if (!is_single_box(_region) || !box_contains(_region.extents, box))
+    {
+        pixman_region32_union_rect(this->to_pixman(), this->to_pixman(),
+            other.x, other.y, other.width, other.height);
+    }
 
     return *this;
 }
 
 wf::region_t& wf::region_t::operator |=(const wf::region_t& other)
 {
-    pixman_region32_union(this->to_pixman(), this->to_pixman(), other.unconst());
+    COUNT_REGION_OP();
+    if (empty())
+    {
+        *this = other;
+    } else if (!other.empty())
+    {
+        pixman_region32_union(this->to_pixman(), this->to_pixman(),
+            other.unconst());
+    }
 
     return *this;
 }
@@ -361,33 +520,56 @@ wf::region_t& wf::region_t::operator |=(const wf::region_t& other)
 /* Subtract the box/region from the current region */
 wf::region_t wf::region_t::operator ^(const wlr_box& box) const
 {
-    wf::region_t result;
-    wf::region_t sub{box};
-    pixman_region32_subtract(result.to_pixman(), this->unconst(), sub.to_pixman());
+    wf::region_t result{*this};
+    result ^= box;
 
     return result;
 }
 
 wf::region_t wf::region_t::operator ^(const wf::region_t& other) const
 {
-    wf::region_t result;
-    pixman_region32_subtract(result.to_pixman(),
-        this->unconst(), other.unconst());
+    wf::region_t result{*this};
+    result ^= other;
 
     return result;
 }
 
 wf::region_t& wf::region_t::operator ^=(const wlr_box& box)
 {
-    wf::region_t sub{box};
-    pixman_region32_subtract(this->to_pixman(),
-        this->to_pixman(), sub.to_pixman());
+    COUNT_REGION_OP();
+    auto sub = pixman_box_from_wlr_box(box);
+    if (empty() || is_empty_box(sub) || !boxes_overlap(_region.extents, sub))
+    {
+        return *this;
+    }
+
+    if (box_contains(sub, _region.extents))
+    {
+        clear();
+    } else
+    {
+        wf::region_t sub_region{box};
+        pixman_region32_subtract(this->to_pixman(),
+            this->to_pixman(), sub_region.to_pixman());
+    }
 
     return *this;
 }
 
 wf::region_t& wf::region_t::operator ^=(const wf::region_t& other)
 {
+    if (is_single_box(other._region))
+    {
+        return *this ^= wlr_box_from_pixman_box(other._region.extents);
+    }
+
+    COUNT_REGION_OP();
+    if (empty() || other.empty() ||
+        !boxes_overlap(_region.extents, other._region.extents))
+    {
+        return *this;
+    }
+
     pixman_region32_subtract(this->to_pixman(),
         this->to_pixman(), other.unconst());
 
@@ -406,6 +588,11 @@ pixman_region32_t*wf::region_t::unconst() const
 
 const pixman_box32_t*wf::region_t::begin() const
 {
+    if (is_single_box(_region))
+    {
+        return &_region.extents;
+    }
+
     int n;
 
     return pixman_region32_rectangles(unconst(), &n);
@@ -413,6 +600,11 @@ const pixman_box32_t*wf::region_t::begin() const
 
 const pixman_box32_t*wf::region_t::end() const
 {
+    if (is_single_box(_region))
+    {
+        return &_region.extents + 1;
+    }
+
     int n;
     auto data = pixman_region32_rectangles(unconst(), &n);
 
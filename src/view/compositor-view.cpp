@@ -3,6 +3,7 @@
 #include <wayfire/opengl.hpp>
 #include <wayfire/compositor-view.hpp>
 #include <wayfire/signal-definitions.hpp>
+#include "view-impl.hpp"
 #include <cstring>
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -105,13 +106,14 @@ void wf::mirror_view_t::move(int x, int y)
 {
     damage();
     view_geometry_changed_signal data;
+    data.view = self();
     data.old_geometry = get_wm_geometry();
 
     this->x = x;
     this->y = y;
 
     damage();
-    emit_signal("geometry-changed", &data);
+    emit_geometry_changed(self(), &data);
 }
 
 wf::geometry_t wf::mirror_view_t::get_output_geometry()
@@ -198,75 +200,114 @@ wf::dimensions_t wf::color_rect_view_t::get_size() const
     };
 }
 
-static void render_colored_rect(const wf::framebuffer_t& fb,
-    int x, int y, int w, int h, const wf::color_t& color)
+static wf::color_t premultiply_alpha(const wf::color_t& color)
 {
-    wf::color_t premultiply{
+    return {
         color.r * color.a,
         color.g * color.a,
         color.b * color.a,
         color.a};
-
-    OpenGL::render_rectangle({x, y, w, h}, premultiply,
-        fb.get_orthographic_projection());
 }
 
 void wf::color_rect_view_t::simple_render(const wf::framebuffer_t& fb, int x, int y,
     const wf::region_t& damage)
 {
-    OpenGL::render_begin(fb);
-    for (const auto& box : damage)
-    {
-        fb.logic_scissor(wlr_box_from_pixman_box(box));
-
-        /* Draw the border, making sure border parts don't overlap, otherwise
-         * we will get wrong corners if border has alpha != 1.0 */
+    static OpenGL::quad_batch_t batch;
+    batch.begin(fb);
+
+    /* Draw the border, making sure border parts don't overlap, otherwise
+     * we will get wrong corners if border has alpha != 1.0. The border and the
+     * inside don't overlap either, so all border parts are drawn first, then
+     * the insides, which needs only two draw calls. */
+    wf::geometry_t border_parts[] = {
         // top
-        render_colored_rect(fb, x, y, geometry.width, border,
-            _border_color);
+        {x, y, geometry.width, border},
         // bottom
-        render_colored_rect(fb, x, y + geometry.height - border,
-            geometry.width, border, _border_color);
+        {x, y + geometry.height - border, geometry.width, border},
         // left
-        render_colored_rect(fb, x, y + border, border,
-            geometry.height - 2 * border, _border_color);
+        {x, y + border, border, geometry.height - 2 * border},
         // right
-        render_colored_rect(fb, x + geometry.width - border,
-            y + border, border, geometry.height - 2 * border, _border_color);
+        {x + geometry.width - border, y + border, border,
+            geometry.height - 2 * border},
+    };
 
-        /* Draw the inside of the rect */
-        render_colored_rect(fb, x + border, y + border,
-            geometry.width - 2 * border, geometry.height - 2 * border,
-            _color);
+    auto border_color = premultiply_alpha(_border_color);
+    for (const auto& box : damage)
+    {
+        for (auto& part : border_parts)
+        {
+            batch.add_rectangle(part, border_color, wlr_box_from_pixman_box(box));
+        }
+    }
+
+    /* Draw the inside of the rect */
+    wf::geometry_t inside = {x + border, y + border,
+        geometry.width - 2 * border, geometry.height - 2 * border};
+    auto color = premultiply_alpha(_color);
+    for (const auto& box : damage)
+    {
+        batch.add_rectangle(inside, color, wlr_box_from_pixman_box(box));
     }
 
+    OpenGL::render_begin(fb);
+    batch.flush();
     OpenGL::render_end();
 }
 
+wf::region_t wf::color_rect_view_t::get_opaque_region(wf::point_t origin)
+{
+    wf::geometry_t box = {origin.x, origin.y, geometry.width, geometry.height};
+    wf::geometry_t inside = {origin.x + border, origin.y + border,
+        geometry.width - 2 * border, geometry.height - 2 * border};
+
+    bool has_inside = (inside.width > 0) && (inside.height > 0);
+
+    wf::region_t opaque;
+    if (_border_color.a >= 1.0)
+    {
+        opaque |= box;
+        if (has_inside)
+        {
+            opaque ^= inside;
+        }
+    }
+
+    if ((_color.a >= 1.0) && has_inside)
+    {
+        opaque |= inside;
+    }
+
+    opaque.expand_edges(-get_active_shrink_constraint());
+
+    return opaque;
+}
+
 void wf::color_rect_view_t::move(int x, int y)
 {
     damage();
     view_geometry_changed_signal data;
+    data.view = self();
     data.old_geometry = get_wm_geometry();
 
     this->geometry.x = x;
     this->geometry.y = y;
 
     damage();
-    emit_signal("geometry-changed", &data);
+    emit_geometry_changed(self(), &data);
 }
 
 void wf::color_rect_view_t::resize(int w, int h)
 {
     damage();
     view_geometry_changed_signal data;
+    data.view = self();
     data.old_geometry = get_wm_geometry();
 
     this->geometry.width  = w;
     this->geometry.height = h;
 
     damage();
-    emit_signal("geometry-changed", &data);
+    emit_geometry_changed(self(), &data);
 }
 
 wf::geometry_t wf::color_rect_view_t::get_output_geometry()
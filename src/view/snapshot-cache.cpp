@@ -0,0 +1,227 @@
+#include "snapshot-cache.hpp"
+#include "view-impl.hpp"
+#include "../core/core-impl.hpp"
+#include <wayfire/view-transform.hpp>
+#include <wayfire/util/log.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+extern "C"
+{
+#include <wlr/backend.h>
+}
+
+/* The snapshot scale is rounded up to multiples of this */
+static constexpr float SNAPSHOT_SCALE_STEP = 1.0 / 8;
+
+static size_t get_snapshot_size(wf::view_interface_t *view)
+{
+    auto& buffer = view->view_impl->offscreen_buffer;
+
+    /* RGBA8 */
+    return (size_t)buffer.viewport_width * buffer.viewport_height * 4;
+}
+
+wf::snapshot_cache_t::snapshot_cache_t()
+{
+    memory_budget_opt.set_callback([=] () { enforce_budget(); });
+    idle_timeout_opt.set_callback([=] () { schedule_idle_release(); });
+
+    /* The timer must be removed before the event loop is destroyed */
+    on_backend_destroy.set_callback([=] (void*)
+    {
+        idle_timer.disconnect();
+        next_cycle.disconnect();
+        on_backend_destroy.disconnect();
+    });
+    on_backend_destroy.connect(&wf::get_core().backend->events.destroy);
+}
+
+wf::snapshot_cache_t::~snapshot_cache_t() = default;
+
+void wf::snapshot_cache_t::use(wf::view_interface_t *view)
+{
+    auto it = std::find_if(entries.begin(), entries.end(),
+        [&] (const entry_t& entry) { return entry.view == view; });
+    if (it == entries.end())
+    {
+        entries.push_back({view, 0, 0});
+        it = std::prev(entries.end());
+    }
+
+    it->last_used  = get_current_time();
+    it->last_cycle = cycle;
+    if (on_backend_destroy.is_connected())
+    {
+        next_cycle.run_once([=] () { ++cycle; });
+    }
+
+    enforce_budget();
+
+    if (!idle_timer.is_connected())
+    {
+        schedule_idle_release();
+    }
+}
+
+void wf::snapshot_cache_t::remove(wf::view_interface_t *view)
+{
+    auto it = std::remove_if(entries.begin(), entries.end(),
+        [&] (const entry_t& entry) { return entry.view == view; });
+    entries.erase(it, entries.end());
+}
+
+float wf::snapshot_cache_t::get_snapshot_scale(wf::view_interface_t *view)
+{
+    if (!downscale_opt)
+    {
+        return 1.0;
+    }
+
+    float scale = 1.0;
+    view->view_impl->transforms.for_each([&] (auto& tr)
+    {
+        scale *= tr->transform->get_snapshot_scale();
+    });
+
+    scale = std::ceil(scale / SNAPSHOT_SCALE_STEP) * SNAPSHOT_SCALE_STEP;
+
+    return std::clamp(scale, SNAPSHOT_SCALE_STEP, 1.0f);
+}
+
+wf::snapshot_cache_stats_t wf::snapshot_cache_t::get_stats() const
+{
+    snapshot_cache_stats_t stats;
+    stats.snapshots = stats.reduced = 0;
+    stats.bytes  = 0;
+    stats.budget = get_budget();
+    stats.released_idle   = released_idle;
+    stats.released_budget = released_budget;
+
+    for (auto& entry : entries)
+    {
+        auto& buffer = entry.view->view_impl->offscreen_buffer;
+        if (!buffer.valid())
+        {
+            continue;
+        }
+
+        ++stats.snapshots;
+        stats.bytes += get_snapshot_size(entry.view);
+        auto output = entry.view->get_output();
+        if (output && (buffer.scale < output->handle->scale))
+        {
+            ++stats.reduced;
+        }
+    }
+
+    return stats;
+}
+
+size_t wf::snapshot_cache_t::get_budget() const
+{
+    return (size_t)std::max(0, (int)memory_budget_opt) * 1024 * 1024;
+}
+
+std::vector<wf::snapshot_cache_t::entry_t>::iterator wf::snapshot_cache_t::release(
+    std::vector<entry_t>::iterator it)
+{
+    /* The view is still mapped, take_snapshot() repaints the whole snapshot
+     * after it has been released, because its size changes. */
+    OpenGL::render_begin();
+    it->view->view_impl->offscreen_buffer.release();
+    OpenGL::render_end();
+
+    return entries.erase(it);
+}
+
+void wf::snapshot_cache_t::enforce_budget()
+{
+    size_t budget = get_budget();
+    if (budget == 0)
+    {
+        return;
+    }
+
+    size_t total = 0;
+    for (auto& entry : entries)
+    {
+        total += get_snapshot_size(entry.view);
+    }
+
+    while (total > budget)
+    {
+        auto lru = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+            if ((it->last_cycle != cycle) && it->view->is_mapped() &&
+                ((lru == entries.end()) || (it->last_used < lru->last_used)))
+            {
+                lru = it;
+            }
+        }
+
+        if (lru == entries.end())
+        {
+            LOGD("View snapshots exceed the memory budget, ",
+                "but none of them can be released");
+            break;
+        }
+
+        total -= get_snapshot_size(lru->view);
+        release(lru);
+        ++released_budget;
+    }
+}
+
+/** Release expired snapshots, and wait for the next snapshot to expire */
+void wf::snapshot_cache_t::schedule_idle_release()
+{
+    int timeout = idle_timeout_opt;
+    if ((timeout <= 0) || !on_backend_destroy.is_connected())
+    {
+        idle_timer.disconnect();
+
+        return;
+    }
+
+    int64_t now  = get_current_time();
+    int64_t next = std::numeric_limits<int64_t>::max();
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        if (!it->view->is_mapped())
+        {
+            ++it;
+            continue;
+        }
+
+        /* Every use of the snapshot goes through take_snapshot(), which
+         * recreates it if it was released, so only the last use matters */
+        if (it->last_used + timeout <= now)
+        {
+            it = release(it);
+            ++released_idle;
+            continue;
+        }
+
+        next = std::min(next, it->last_used + timeout);
+        ++it;
+    }
+
+    if (next == std::numeric_limits<int64_t>::max())
+    {
+        idle_timer.disconnect();
+
+        return;
+    }
+
+    idle_timer.set_timeout(std::max<int64_t>(1, next - now),
+        [=] () { schedule_idle_release(); });
+}
+
+wf::snapshot_cache_stats_t wf::get_snapshot_cache_stats()
+{
+    return wf::get_core_impl().snapshot_cache->get_stats();
+}
@@ -0,0 +1,82 @@
+#ifndef WF_VIEW_SNAPSHOT_CACHE_HPP
+#define WF_VIEW_SNAPSHOT_CACHE_HPP
+
+#include <wayfire/object.hpp>
+#include <wayfire/option-wrapper.hpp>
+#include <wayfire/util.hpp>
+#include <wayfire/view.hpp>
+#include <vector>
+
+namespace wf
+{
+/**
+ * Keeps track of the snapshots (offscreen buffers) of all views.
+ *
+ * Snapshots of mapped views can always be recreated, so they are released
+ * when they have not been used for core/snapshot_idle_timeout, for example
+ * because the view's transformers are rendered without a snapshot. If all
+ * snapshots together need more than core/snapshot_memory_budget, the least
+ * recently used snapshots of mapped views are released too, except those
+ * used in the current repaint cycle. Snapshots of unmapped views are kept
+ * until the view is destroyed, since they cannot be recreated.
+ */
+class snapshot_cache_t : public noncopyable_t
+{
+  public:
+    snapshot_cache_t();
+    ~snapshot_cache_t();
+
+    /**
+     * Mark the snapshot of the view as used. Must be called after the snapshot
+     * has been (re)allocated, so that the budget can be enforced. Snapshots
+     * used in the current repaint cycle, including the one of the given view,
+     * are not released by this call.
+     */
+    void use(wf::view_interface_t *view);
+
+    /** Stop tracking the snapshot of the view, before it is released */
+    void remove(wf::view_interface_t *view);
+
+    /**
+     * @return The scale, relative to the output scale, at which the snapshot
+     *   of the view should be rendered. It is the product of the snapshot
+     *   scales of the view's transformers, rounded up to 1/8 so that
+     *   animations do not reallocate the snapshot on every frame.
+     */
+    float get_snapshot_scale(wf::view_interface_t *view);
+
+    snapshot_cache_stats_t get_stats() const;
+
+  private:
+    wf::option_wrapper_t<int> memory_budget_opt{"core/snapshot_memory_budget"};
+    wf::option_wrapper_t<int> idle_timeout_opt{"core/snapshot_idle_timeout"};
+    wf::option_wrapper_t<bool> downscale_opt{"core/snapshot_downscale"};
+
+    struct entry_t
+    {
+        wf::view_interface_t *view;
+        int64_t last_used;
+        /* The repaint cycle in which the snapshot was last used */
+        uint64_t last_cycle;
+    };
+
+    std::vector<entry_t> entries;
+    /* Incremented once the event loop is idle after snapshots were used, i.e
+     * after all outputs which were due have been repainted */
+    uint64_t cycle = 0;
+    wf::wl_idle_call next_cycle;
+    uint64_t released_idle   = 0;
+    uint64_t released_budget = 0;
+
+    wf::wl_timer idle_timer;
+    wf::wl_listener_wrapper on_backend_destroy;
+
+    size_t get_budget() const;
+    /** Release the snapshot and stop tracking it */
+    std::vector<entry_t>::iterator release(std::vector<entry_t>::iterator it);
+    void enforce_budget();
+    void schedule_idle_release();
+};
+}
+
+#endif /* end of include guard: WF_VIEW_SNAPSHOT_CACHE_HPP */
@@ -29,6 +29,12 @@ class surface_interface_t::impl
      * subtract_opaque(), send_frame_done(), etc. work for the surface
      */
     wlr_surface *wsurface = nullptr;
+
+    /**
+     * The last time (in milliseconds) the render manager sent a frame
+     * callback to the surface. Used to throttle occluded surfaces.
+     */
+    uint32_t last_frame_done = 0;
 };
 
 /**
@@ -398,13 +398,16 @@ void wf::wlr_surface_base_t::_simple_render(const wf::framebuffer_t& fb,
     wf::geometry_t geometry = {x, y, size.width, size.height};
     wf::texture_t texture{surface->buffer->texture};
 
-    OpenGL::render_begin(fb);
+    /* Draw all damaged rectangles with a single draw call */
+    static OpenGL::quad_batch_t batch;
+    batch.begin(fb);
     for (const auto& rect : damage)
     {
-        fb.logic_scissor(wlr_box_from_pixman_box(rect));
-        OpenGL::render_texture(texture, fb, geometry);
+        batch.add_texture(texture, geometry, wlr_box_from_pixman_box(rect));
     }
 
+    OpenGL::render_begin(fb);
+    batch.flush();
     OpenGL::render_end();
 }
 
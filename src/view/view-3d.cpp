@@ -145,6 +145,35 @@ wf::pointf_t wf::view_2D::untransform_point(
     return get_absolute_coords_from_relative(view->get_wm_geometry(), {x, y});
 }
 
+float wf::view_2D::get_snapshot_scale()
+{
+    return std::min(1.0f, std::max(std::abs(scale_x), std::abs(scale_y)));
+}
+
+uint32_t wf::view_2D::get_capabilities()
+{
+    return TRANSFORMER_CAP_DIRECT;
+}
+
+glm::mat4 wf::view_2D::get_direct_transform(wf::geometry_t geometry,
+    glm::vec4& color)
+{
+    /* Same as render_box(), but in output-local coordinates, where the Y axis
+     * points down instead of up */
+    auto center = get_center(view->get_wm_geometry());
+    auto flip_y = glm::scale(glm::mat4(1.0), {1, -1, 1});
+
+    auto to_center   = glm::translate(glm::mat4(1.0), {-center.x, -center.y, 0});
+    auto scale       = glm::scale(glm::mat4(1.0), {scale_x, scale_y, 1});
+    auto rotate      = glm::rotate(glm::mat4(1.0), angle, {0, 0, 1});
+    auto from_center = glm::translate(glm::mat4(1.0),
+        {center.x + translation_x, center.y + translation_y, 0});
+
+    color.a *= alpha;
+
+    return from_center * flip_y * rotate * flip_y * scale * to_center;
+}
+
 void wf::view_2D::render_box(wf::texture_t src_tex, wlr_box src_box,
     wlr_box scissor_box, const wf::framebuffer_t& fb)
 {
@@ -4,6 +4,7 @@
 #include <wayfire/nonstd/safe-list.hpp>
 #include <wayfire/view.hpp>
 #include <wayfire/opengl.hpp>
+#include <wayfire/signal-definitions.hpp>
 
 #include "surface-impl.hpp"
 
@@ -24,7 +25,6 @@ struct view_transform_block_t : public noncopyable_t
 {
     std::string plugin_name = "";
     std::unique_ptr<wf::view_transformer_t> transform;
-    wf::framebuffer_t fb;
 
     view_transform_block_t();
     ~view_transform_block_t();
@@ -213,6 +213,19 @@ class wlr_view_t :
 /** Emit the map signal for the given view */
 void emit_view_map_signal(wayfire_view view, bool has_position);
 
+/**
+ * Emit the geometry-changed signal on the view, and view-geometry-changed on
+ * core and the view's output.
+ */
+void emit_geometry_changed(wayfire_view view,
+    wf::view_geometry_changed_signal *data);
+
+/**
+ * @return A counter which is incremented whenever a transformer is added to or
+ *   removed from any view.
+ */
+uint64_t get_transformers_generation();
+
 wf::surface_interface_t *wf_surface_from_void(void *handle);
 wf::view_interface_t *wf_view_from_void(void *handle);
 
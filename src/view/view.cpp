@@ -1,6 +1,7 @@
 #include <wayfire/util/log.hpp>
 #include "../core/core-impl.hpp"
 #include "view-impl.hpp"
+#include "snapshot-cache.hpp"
 #include "wayfire/opengl.hpp"
 #include "wayfire/output.hpp"
 #include "wayfire/view.hpp"
@@ -14,6 +15,7 @@
 #include <algorithm>
 #include <glm/glm.hpp>
 #include "wayfire/signal-definitions.hpp"
+#include <wayfire/nonstd/reverse.hpp>
 
 extern "C"
 {
@@ -741,10 +743,17 @@ void wf::view_interface_t::add_transformer(
     add_transformer(std::move(transformer), "");
 }
 
+static uint64_t transformers_generation = 0;
+uint64_t wf::get_transformers_generation()
+{
+    return transformers_generation;
+}
+
 void wf::view_interface_t::add_transformer(
     std::unique_ptr<wf::view_transformer_t> transformer, std::string name)
 {
     damage();
+    ++transformers_generation;
 
     auto tr = std::make_shared<wf::view_transform_block_t>();
     tr->transform   = std::move(transformer);
@@ -785,6 +794,7 @@ void wf::view_interface_t::pop_transformer(
     {
         return tr->transform.get() == transformer.get();
     });
+    ++transformers_generation;
 
     /* Since we can remove transformers while rendering the output, damaging it
      * won't help at this stage (damage is already calculated).
@@ -930,13 +940,94 @@ wf::region_t wf::view_interface_t::get_transformed_opaque_region()
     this->view_impl->transforms.for_each(
         [&] (const std::shared_ptr<view_transform_block_t> tr)
     {
-        opaque = tr->transform->transform_opaque_region(bbox, opaque);
+        opaque = tr->transform->transform_opaque_region(bbox, std::move(opaque));
         bbox   = tr->transform->get_bounding_box(bbox, bbox);
     });
 
     return opaque;
 }
 
+/**
+ * Render the surfaces of a mapped view directly to the framebuffer, if all of
+ * its transformers support TRANSFORMER_CAP_DIRECT.
+ *
+ * @return Whether the view was rendered.
+ */
+static bool render_direct(wf::view_interface_t *view,
+    const wf::framebuffer_t& framebuffer, const wf::region_t& damage)
+{
+    bool direct = true;
+    glm::mat4 transform{1.0};
+    glm::vec4 color{1.0};
+    auto bbox = view->get_untransformed_bounding_box();
+    view->view_impl->transforms.for_each([&] (auto& tr)
+    {
+        if (!direct || !(tr->transform->get_capabilities() &
+                         wf::TRANSFORMER_CAP_DIRECT))
+        {
+            direct = false;
+
+            return;
+        }
+
+        transform = tr->transform->get_direct_transform(bbox, color) * transform;
+        bbox = tr->transform->get_bounding_box(bbox, bbox);
+    });
+
+    if (!direct)
+    {
+        return false;
+    }
+
+    auto og = view->get_output_geometry();
+    auto children = view->enumerate_surfaces({og.x, og.y});
+    std::vector<wf::geometry_t> boxes;
+    for (auto& child : children)
+    {
+        auto surface = child.surface->get_wlr_surface();
+        if (!surface || !surface->buffer)
+        {
+            return false;
+        }
+
+        wf::geometry_t box = {child.position.x, child.position.y,
+            child.surface->get_size().width, child.surface->get_size().height};
+
+        /* Translucent surfaces would show through each other, unlike in the
+         * snapshot, where they are blended before the transform */
+        if (color.a < 1.0)
+        {
+            for (auto& other : boxes)
+            {
+                if (!(wf::region_t{box} & other).empty())
+                {
+                    return false;
+                }
+            }
+        }
+
+        boxes.push_back(box);
+    }
+
+    auto matrix = framebuffer.get_orthographic_projection() * transform;
+    OpenGL::render_begin(framebuffer);
+    for (size_t i = children.size(); i > 0; i--)
+    {
+        auto surface = children[i - 1].surface->get_wlr_surface();
+        wf::texture_t texture{surface->buffer->texture};
+        for (const auto& rect : damage)
+        {
+            framebuffer.logic_scissor(wlr_box_from_pixman_box(rect));
+            OpenGL::render_transformed_texture(texture, boxes[i - 1],
+                matrix, color);
+        }
+    }
+
+    OpenGL::render_end();
+
+    return true;
+}
+
 bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuffer,
     const wf::region_t& damage)
 {
@@ -945,6 +1036,12 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
         return false;
     }
 
+    /* Affine transforms are applied to each surface instead of the snapshot */
+    if (is_mapped() && render_direct(this, framebuffer, damage))
+    {
+        return true;
+    }
+
     wf::geometry_t obox = get_untransformed_bounding_box();
     wf::texture_t previous_texture;
     float texture_scale;
@@ -963,13 +1060,10 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
         texture_scale    = view_impl->offscreen_buffer.scale;
     }
 
-    /* We keep a shared_ptr to the previous transform which we executed, so that
-     * even if it gets removed, its texture remains valid.
-     *
-     * NB: we do not call previous_transform's transformer functions after the
-     * cycle is complete, because the memory might have already been freed.
-     * We only know that the texture is still alive. */
-    std::shared_ptr<view_transform_block_t> previous_transform = nullptr;
+    /* The results of the last two transformers. They are borrowed from the
+     * framebuffer pool, so views of the same size share them, and returned as
+     * soon as the next transformer has read them. */
+    wf::framebuffer_t previous_fb, current_fb;
 
     /* final_transform is the one that should render to the screen */
     std::shared_ptr<view_transform_block_t> final_transform = nullptr;
@@ -996,19 +1090,24 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
 
         /* Prepare buffer to store result after the transform */
         OpenGL::render_begin();
-        transform->fb.allocate(scaled_width, scaled_height);
-        transform->fb.scale    = texture_scale;
-        transform->fb.geometry = transformed_box;
-        transform->fb.bind(); // bind buffer to clear it
+        OpenGL::borrow_framebuffer(current_fb, scaled_width, scaled_height);
+        current_fb.scale    = texture_scale;
+        current_fb.geometry = transformed_box;
+        current_fb.bind(); // bind buffer to clear it
         OpenGL::clear({0, 0, 0, 0});
         OpenGL::render_end();
 
         /* Actually render the transform to the next framebuffer */
         transform->transform->render_with_damage(previous_texture, obox,
-            wf::region_t{transformed_box}, transform->fb);
+            wf::region_t{transformed_box}, current_fb);
+
+        if (previous_fb.fb != (uint32_t)-1)
+        {
+            OpenGL::return_framebuffer(previous_fb);
+        }
 
-        previous_transform = transform;
-        previous_texture   = previous_transform->fb.tex;
+        std::swap(previous_fb, current_fb);
+        previous_texture = previous_fb.tex;
         obox = transformed_box;
     });
 
@@ -1021,21 +1120,16 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
      * framebuffer. */
     if (final_transform == nullptr)
     {
-        OpenGL::render_begin(framebuffer);
-        auto matrix = framebuffer.get_orthographic_projection();
-        gl_geometry src_geometry = {
-            1.0f * obox.x, 1.0f * obox.y,
-            1.0f * obox.x + 1.0f * obox.width,
-            1.0f * obox.y + 1.0f * obox.height,
-        };
-
+        static OpenGL::quad_batch_t batch;
+        batch.begin(framebuffer);
         for (const auto& rect : damage)
         {
-            framebuffer.logic_scissor(wlr_box_from_pixman_box(rect));
-            OpenGL::render_transformed_texture(previous_texture, src_geometry,
-                {}, matrix);
+            batch.add_texture(previous_texture, obox,
+                wlr_box_from_pixman_box(rect));
         }
 
+        OpenGL::render_begin(framebuffer);
+        batch.flush();
         OpenGL::render_end();
     } else
     {
@@ -1045,17 +1139,18 @@ bool wf::view_interface_t::render_transformed(const wf::framebuffer_t& framebuff
             damage, framebuffer);
     }
 
+    if (previous_fb.fb != (uint32_t)-1)
+    {
+        OpenGL::return_framebuffer(previous_fb);
+    }
+
     return true;
 }
 
 wf::view_transform_block_t::view_transform_block_t()
 {}
 wf::view_transform_block_t::~view_transform_block_t()
-{
-    OpenGL::render_begin();
-    this->fb.release();
-    OpenGL::render_end();
-}
+{}
 
 void wf::view_interface_t::take_snapshot()
 {
@@ -1065,19 +1160,15 @@ void wf::view_interface_t::take_snapshot()
     }
 
     auto& offscreen_buffer = view_impl->offscreen_buffer;
+    auto& snapshot_cache   = *wf::get_core_impl().snapshot_cache;
 
     auto buffer_geometry = get_untransformed_bounding_box();
     offscreen_buffer.geometry = buffer_geometry;
 
-    float scale = get_output()->handle->scale;
-
-    offscreen_buffer.cached_damage &= buffer_geometry;
-    /* Nothing has changed, the last buffer is still valid */
-    if (offscreen_buffer.cached_damage.empty())
-    {
-        return;
-    }
+    float scale = get_output()->handle->scale *
+        snapshot_cache.get_snapshot_scale(this);
 
+    /* The buffer was released, or the view or its scale changed */
     int scaled_width  = buffer_geometry.width * scale;
     int scaled_height = buffer_geometry.height * scale;
     if ((scaled_width != offscreen_buffer.viewport_width) ||
@@ -1086,6 +1177,15 @@ void wf::view_interface_t::take_snapshot()
         offscreen_buffer.cached_damage |= buffer_geometry;
     }
 
+    offscreen_buffer.cached_damage &= buffer_geometry;
+    /* Nothing has changed, the last buffer is still valid */
+    if (offscreen_buffer.cached_damage.empty())
+    {
+        snapshot_cache.use(this);
+
+        return;
+    }
+
     OpenGL::render_begin();
     offscreen_buffer.allocate(scaled_width, scaled_height);
     offscreen_buffer.scale = scale;
@@ -1115,6 +1215,7 @@ void wf::view_interface_t::take_snapshot()
     }
 
     offscreen_buffer.cached_damage.clear();
+    snapshot_cache.use(this);
 }
 
 wf::view_interface_t::view_interface_t()
@@ -1148,6 +1249,7 @@ void wf::view_interface_t::deinitialize()
     this->view_impl->transforms.clear();
     this->_clear_data();
 
+    wf::get_core_impl().snapshot_cache->remove(this);
     OpenGL::render_begin();
     this->view_impl->offscreen_buffer.release();
     OpenGL::render_end();
@@ -1203,7 +1305,12 @@ void wf::view_damage_raw(wayfire_view view, const wlr_box& box)
         output->render->damage(box);
     }
 
-    view->emit_signal("region-damaged", nullptr);
+    static const wf::signal_id_t region_damaged =
+        wf::get_signal_id("region-damaged");
+    wf::view_region_damaged_signal data;
+    data.view = view;
+    data.box  = box;
+    view->emit_signal(region_damaged, &data);
 }
 
 void wf::view_interface_t::destruct()